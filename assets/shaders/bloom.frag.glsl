@@ -0,0 +1,21 @@
+// Downsamples 'src_texture'. With BLOOM_UPSAMPLE the smaller 'src_texture' is
+// upsampled and added to 'curr_texture' instead.
+
+layout (location = 0) out vec4 frag_color;
+
+in vec2 f_uv;
+
+uniform sampler2D src_texture;
+#ifdef BLOOM_UPSAMPLE
+uniform sampler2D curr_texture;
+#endif
+
+#include "sampling.glsl"
+
+void main() {
+    vec3 c = box_samp(src_texture, f_uv, 1.0);
+#ifdef BLOOM_UPSAMPLE
+    c += box_samp(curr_texture, f_uv, 1.0);
+#endif
+    frag_color = vec4(c, 1.0);
+}
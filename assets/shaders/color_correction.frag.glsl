@@ -1,9 +1,3 @@
-#version 300 es
-
-#ifdef GL_ES
-precision mediump float;
-#endif
-
 out vec4 frag_color;
 
 in vec2 f_uv;
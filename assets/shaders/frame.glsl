@@ -0,0 +1,8 @@
+// Constants of the whole frame, uploaded once per frame. Mirrors
+// 'frame_constants_t'. The precision is explicit since blocks included by
+// both stages of a program need to match.
+layout (std140) uniform frame_constants {
+    highp mat4 proj;
+    highp vec4 ambient_color;
+    highp float time;
+};
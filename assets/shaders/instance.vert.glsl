@@ -0,0 +1,23 @@
+layout (location = 0) in vec2 v_pos;
+layout (location = 1) in vec2 v_uv;
+
+// Per instance
+layout (location = 2) in vec3 i_pos;
+layout (location = 3) in vec3 i_size;
+layout (location = 4) in vec4 i_color;
+layout (location = 5) in float i_intensity;
+
+out vec2 f_uv;
+out vec4 f_color;
+out float f_intensity;
+
+#include "frame.glsl"
+
+void main() {
+    f_uv = v_uv;
+    f_color = i_color;
+    f_intensity = i_intensity;
+
+    vec3 pos = vec3(v_pos, 0.0) * i_size + i_pos;
+    gl_Position = proj * vec4(pos, 1.0);
+}
@@ -1,9 +1,3 @@
-#version 300 es
-
-#ifdef GL_ES
-precision mediump float;
-#endif
-
 layout(location = 0) out vec4 frag_color;
 layout(location = 1) out vec4 bloom_color;
 
@@ -11,7 +5,8 @@ in vec2 f_uv;
 
 uniform sampler2D obj;
 uniform sampler2D light;
-uniform vec4 ambient_color;
+
+#include "frame.glsl"
 
 void main() {
     vec4 obj_color_full = texture(obj, f_uv);
@@ -0,0 +1,510 @@
+//
+// Deterministic benchmark of the lighting pipeline. Renders a generated scene
+// with the headless backend and reports CPU frame times, GPU pass times, draw
+// calls and state changes as CSV or JSON.
+//
+// The scene is generated from a seed and the clock advances a fixed step per
+// frame, so two runs with the same arguments render exactly the same frames.
+//
+
+#include "core.h"
+#include "program.h"
+#include "render_api.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <glad/gl.h>
+
+typedef enum {
+    RADIUS_DIST_UNIFORM,
+    // Many small lights and few large ones.
+    RADIUS_DIST_EXPONENTIAL,
+    RADIUS_DIST_FIXED,
+} radius_dist_t;
+
+typedef enum {
+    OUTPUT_FORMAT_CSV,
+    OUTPUT_FORMAT_JSON,
+} output_format_t;
+
+typedef struct bench_config_t bench_config_t;
+struct bench_config_t {
+    u32 obj_count;
+    u32 light_count;
+    radius_dist_t radius_dist;
+    f32 radius_min;
+    f32 radius_max;
+    u32 width;
+    u32 height;
+    u32 bloom_passes;
+    u32 warmup_frames;
+    u32 frames;
+    u32 seed;
+    output_format_t format;
+    const char* output;
+};
+
+static const char* radius_dist_names[] = {
+    [RADIUS_DIST_UNIFORM] = "uniform",
+    [RADIUS_DIST_EXPONENTIAL] = "exponential",
+    [RADIUS_DIST_FIXED] = "fixed",
+};
+
+static void usage(const char* program) {
+    printf(
+        "Usage: %s [options]\n"
+        "  --objects N          Number of objects (default 64)\n"
+        "  --lights N           Number of lights (default 16)\n"
+        "  --radius MIN:MAX     Light radius range in world units (default 0.5:4)\n"
+        "  --radius-dist DIST   uniform, exponential or fixed (default uniform)\n"
+        "  --size WxH           Resolution (default 1280x720)\n"
+        "  --bloom-passes N     Bloom pass limit (default 16)\n"
+        "  --warmup N           Frames rendered before measuring (default 30)\n"
+        "  --frames N           Measured frames (default 300)\n"
+        "  --seed N             Scene generator seed (default 1)\n"
+        "  --format FORMAT      csv or json (default csv)\n"
+        "  --output FILE        Write results to FILE instead of stdout\n",
+        program);
+}
+
+static b8 parse_args(bench_config_t* config, i32 argc, char** argv) {
+    for (i32 i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0) {
+            return false;
+        }
+        if (i + 1 == argc) {
+            printf("ERROR: Missing value for '%s'.\n", arg);
+            return false;
+        }
+        const char* value = argv[++i];
+
+        b8 valid = true;
+        if (strcmp(arg, "--objects") == 0) {
+            config->obj_count = strtoul(value, NULL, 10);
+        } else if (strcmp(arg, "--lights") == 0) {
+            config->light_count = strtoul(value, NULL, 10);
+        } else if (strcmp(arg, "--radius") == 0) {
+            valid = sscanf(value, "%f:%f", &config->radius_min, &config->radius_max) == 2 &&
+                config->radius_min > 0.0f && config->radius_min <= config->radius_max;
+        } else if (strcmp(arg, "--radius-dist") == 0) {
+            valid = false;
+            for (u32 j = 0; j < arr_len(radius_dist_names); j++) {
+                if (strcmp(value, radius_dist_names[j]) == 0) {
+                    config->radius_dist = j;
+                    valid = true;
+                }
+            }
+        } else if (strcmp(arg, "--size") == 0) {
+            valid = sscanf(value, "%ux%u", &config->width, &config->height) == 2 &&
+                config->width > 0 && config->height > 0;
+        } else if (strcmp(arg, "--bloom-passes") == 0) {
+            config->bloom_passes = strtoul(value, NULL, 10);
+        } else if (strcmp(arg, "--warmup") == 0) {
+            config->warmup_frames = strtoul(value, NULL, 10);
+        } else if (strcmp(arg, "--frames") == 0) {
+            config->frames = strtoul(value, NULL, 10);
+            valid = config->frames > 0;
+        } else if (strcmp(arg, "--seed") == 0) {
+            config->seed = strtoul(value, NULL, 10);
+        } else if (strcmp(arg, "--format") == 0) {
+            if (strcmp(value, "csv") == 0) {
+                config->format = OUTPUT_FORMAT_CSV;
+            } else if (strcmp(value, "json") == 0) {
+                config->format = OUTPUT_FORMAT_JSON;
+            } else {
+                valid = false;
+            }
+        } else if (strcmp(arg, "--output") == 0) {
+            config->output = value;
+        } else {
+            printf("ERROR: Unknown option '%s'.\n", arg);
+            return false;
+        }
+
+        if (!valid) {
+            printf("ERROR: Invalid value '%s' for '%s'.\n", value, arg);
+            return false;
+        }
+    }
+    return true;
+}
+
+// -- Scene generation ---------------------------------------------------------
+
+// xorshift32. Used instead of rand() so scenes are the same on every libc.
+static u32 rng_next(u32* state) {
+    u32 x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+// Uniform in [0, 1).
+static f32 rng_f32(u32* state) {
+    return (f32) (rng_next(state) >> 8) / (f32) (1 << 24);
+}
+
+static f32 rng_range(u32* state, f32 min, f32 max) {
+    return lerp(min, max, rng_f32(state));
+}
+
+static f32 light_radius(const bench_config_t* config, u32* rng) {
+    switch (config->radius_dist) {
+        case RADIUS_DIST_UNIFORM:
+            return rng_range(rng, config->radius_min, config->radius_max);
+        case RADIUS_DIST_EXPONENTIAL: {
+            // Mean a quarter of the range, clamped to it.
+            f32 mean = (config->radius_max - config->radius_min) * 0.25f;
+            f32 radius = config->radius_min - logf(1.0f - rng_f32(rng)) * mean;
+            return min(radius, config->radius_max);
+        }
+        case RADIUS_DIST_FIXED:
+            return config->radius_max;
+    }
+    return config->radius_max;
+}
+
+// Lights orbit around a fixed center so every frame is different but
+// reproducible.
+typedef struct light_orbit_t light_orbit_t;
+struct light_orbit_t {
+    Vec2 center;
+    f32 radius;
+    f32 speed;
+    f32 phase;
+};
+
+typedef struct bench_scene_t bench_scene_t;
+struct bench_scene_t {
+    obj_t* objs;
+    light_t* lights;
+    light_orbit_t* orbits;
+    scene_t scene;
+};
+
+static bench_scene_t bench_scene_generate(const bench_config_t* config) {
+    u32 rng = config->seed != 0 ? config->seed : 1;
+    // Matches the view of the app's projection.
+    const f32 zoom = 5.0f;
+    Vec2 extent = vec2((f32) config->width / (f32) config->height * zoom, zoom);
+
+    bench_scene_t bench = {
+        .objs = malloc(config->obj_count * sizeof(obj_t)),
+        .lights = malloc(config->light_count * sizeof(light_t)),
+        .orbits = malloc(config->light_count * sizeof(light_orbit_t)),
+    };
+
+    // Every value is drawn in its own statement since the evaluation order of
+    // function arguments is unspecified.
+    for (u32 i = 0; i < config->obj_count; i++) {
+        f32 x = rng_range(&rng, -extent.x, extent.x);
+        f32 y = rng_range(&rng, -extent.y, extent.y);
+        f32 width = rng_range(&rng, 0.1f, 1.0f);
+        f32 height = rng_range(&rng, 0.1f, 1.0f);
+        f32 hue = rng_range(&rng, 0.0f, 360.0f);
+        f32 saturation = rng_range(&rng, 0.25f, 1.0f);
+        bench.objs[i] = (obj_t) {
+            .pos = vec3(x, y, 0.0f),
+            .size = vec3(width, height, 1.0f),
+            .color = color_hsv(hue, saturation, 1.0f),
+        };
+    }
+
+    for (u32 i = 0; i < config->light_count; i++) {
+        f32 radius = light_radius(config, &rng);
+        f32 hue = rng_range(&rng, 0.0f, 360.0f);
+        f32 saturation = rng_range(&rng, 0.5f, 1.0f);
+        f32 intensity = rng_range(&rng, 0.5f, 2.0f);
+        bench.lights[i] = (light_t) {
+            .size = vec3(radius * 2.0f, radius * 2.0f, 1.0f),
+            .color = color_hsv(hue, saturation, 1.0f),
+            .intensity = intensity,
+        };
+
+        f32 x = rng_range(&rng, -extent.x, extent.x);
+        f32 y = rng_range(&rng, -extent.y, extent.y);
+        f32 orbit_radius = rng_range(&rng, 0.0f, 2.0f);
+        f32 speed = rng_range(&rng, -2.0f, 2.0f);
+        f32 phase = rng_range(&rng, 0.0f, 2.0f*PI);
+        bench.orbits[i] = (light_orbit_t) {
+            .center = vec2(x, y),
+            .radius = orbit_radius,
+            .speed = speed,
+            .phase = phase,
+        };
+    }
+
+    bench.scene = (scene_t) {
+        .objs = bench.objs,
+        .obj_count = config->obj_count,
+        .lights = bench.lights,
+        .light_count = config->light_count,
+    };
+
+    return bench;
+}
+
+static void bench_scene_update(bench_scene_t* bench, f32 time) {
+    for (u32 i = 0; i < bench->scene.light_count; i++) {
+        light_orbit_t orbit = bench->orbits[i];
+        f32 angle = orbit.phase + orbit.speed * time;
+        bench->lights[i].pos = vec3(
+                orbit.center.x + cosf(angle) * orbit.radius,
+                orbit.center.y + sinf(angle) * orbit.radius,
+                0.0f
+            );
+    }
+}
+
+static void bench_scene_free(bench_scene_t* bench) {
+    free(bench->objs);
+    free(bench->lights);
+    free(bench->orbits);
+}
+
+// -- Measurement --------------------------------------------------------------
+
+typedef struct frame_sample_t frame_sample_t;
+struct frame_sample_t {
+    f32 cpu_ms;
+    render_stats_t render;
+    batch_stats_t batch;
+    u64 frame_arena_bytes;
+};
+
+typedef struct summary_t summary_t;
+struct summary_t {
+    f32 min;
+    f32 avg;
+    f32 p50;
+    f32 p95;
+    f32 max;
+};
+
+static f64 time_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (f64) ts.tv_sec * 1e3 + (f64) ts.tv_nsec * 1e-6;
+}
+
+static i32 f32_cmp(const void* a, const void* b) {
+    f32 x = *(const f32*) a;
+    f32 y = *(const f32*) b;
+    return (x > y) - (x < y);
+}
+
+// Sorts 'values' in place.
+static summary_t summarize(f32* values, u32 count) {
+    qsort(values, count, sizeof(f32), f32_cmp);
+    f64 sum = 0.0;
+    for (u32 i = 0; i < count; i++) {
+        sum += values[i];
+    }
+    return (summary_t) {
+        .min = values[0],
+        .avg = sum / count,
+        .p50 = values[(count - 1) * 50 / 100],
+        .p95 = values[(count - 1) * 95 / 100],
+        .max = values[count - 1],
+    };
+}
+
+static void frame_render(renderer_t* rend, app_t* app, bench_scene_t* scene) {
+    renderer_frame_begin(rend);
+    bench_scene_update(scene, get_time());
+    app_update(app, renderer_frame_arena(rend));
+    renderer_swap_buffers(rend);
+}
+
+// -- Output -------------------------------------------------------------------
+
+typedef struct results_t results_t;
+struct results_t {
+    summary_t cpu_ms;
+    summary_t draw_calls;
+    summary_t state_changes;
+    summary_t state_changes_skipped;
+    summary_t uniform_updates;
+    summary_t batch_flushes;
+    summary_t batch_bytes_uploaded;
+    summary_t frame_arena_bytes;
+};
+
+static void write_csv(FILE* fp, const results_t* results) {
+    fprintf(fp, "metric,min,avg,p50,p95,max,samples\n");
+    struct { const char* name; const summary_t* summary; } rows[] = {
+        {"cpu_frame_ms", &results->cpu_ms},
+        {"draw_calls", &results->draw_calls},
+        {"state_changes", &results->state_changes},
+        {"state_changes_skipped", &results->state_changes_skipped},
+        {"uniform_updates", &results->uniform_updates},
+        {"batch_flushes", &results->batch_flushes},
+        {"batch_bytes_uploaded", &results->batch_bytes_uploaded},
+        {"frame_arena_bytes", &results->frame_arena_bytes},
+    };
+    for (u32 i = 0; i < arr_len(rows); i++) {
+        const summary_t* s = rows[i].summary;
+        fprintf(fp, "%s,%.4f,%.4f,%.4f,%.4f,%.4f,\n", rows[i].name, s->min, s->avg, s->p50, s->p95, s->max);
+    }
+    // GPU timers only keep min, avg and max.
+    for (u32 i = 0; i < gpu_timer_scope_count(); i++) {
+        gpu_timer_stats_t stats = gpu_timer_scope_stats(i);
+        fprintf(fp, "gpu_ms:%s,%.4f,%.4f,,,%.4f,%u\n", stats.name, stats.min_ms, stats.avg_ms, stats.max_ms, stats.sample_count);
+    }
+}
+
+static void write_json_summary(FILE* fp, const char* name, const summary_t* s, b8 last) {
+    fprintf(fp, "  \"%s\": {\"min\": %.4f, \"avg\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"max\": %.4f}%s\n",
+            name, s->min, s->avg, s->p50, s->p95, s->max, last ? "" : ",");
+}
+
+static void write_json(FILE* fp, const bench_config_t* config, const results_t* results) {
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"config\": {\"objects\": %u, \"lights\": %u, \"radius_min\": %.4f, \"radius_max\": %.4f, "
+            "\"radius_dist\": \"%s\", \"width\": %u, \"height\": %u, \"bloom_passes\": %u, "
+            "\"warmup\": %u, \"frames\": %u, \"seed\": %u},\n",
+            config->obj_count, config->light_count, config->radius_min, config->radius_max,
+            radius_dist_names[config->radius_dist], config->width, config->height, config->bloom_passes,
+            config->warmup_frames, config->frames, config->seed);
+    fprintf(fp, "  \"renderer\": \"%s\",\n", (const char*) glGetString(GL_RENDERER));
+    write_json_summary(fp, "cpu_frame_ms", &results->cpu_ms, false);
+    write_json_summary(fp, "draw_calls", &results->draw_calls, false);
+    write_json_summary(fp, "state_changes", &results->state_changes, false);
+    write_json_summary(fp, "state_changes_skipped", &results->state_changes_skipped, false);
+    write_json_summary(fp, "uniform_updates", &results->uniform_updates, false);
+    write_json_summary(fp, "batch_flushes", &results->batch_flushes, false);
+    write_json_summary(fp, "batch_bytes_uploaded", &results->batch_bytes_uploaded, false);
+    write_json_summary(fp, "frame_arena_bytes", &results->frame_arena_bytes, false);
+    fprintf(fp, "  \"gpu_ms\": {");
+    for (u32 i = 0; i < gpu_timer_scope_count(); i++) {
+        gpu_timer_stats_t stats = gpu_timer_scope_stats(i);
+        fprintf(fp, "%s\n    \"%s\": {\"min\": %.4f, \"avg\": %.4f, \"max\": %.4f, \"samples\": %u}",
+                i == 0 ? "" : ",", stats.name, stats.min_ms, stats.avg_ms, stats.max_ms, stats.sample_count);
+    }
+    fprintf(fp, "%s}\n", gpu_timer_scope_count() == 0 ? "" : "\n  ");
+    fprintf(fp, "}\n");
+}
+
+i32 main(i32 argc, char** argv) {
+    bench_config_t config = {
+        .obj_count = 64,
+        .light_count = 16,
+        .radius_dist = RADIUS_DIST_UNIFORM,
+        .radius_min = 0.5f,
+        .radius_max = 4.0f,
+        .width = 1280,
+        .height = 720,
+        .bloom_passes = 16,
+        .warmup_frames = 30,
+        .frames = 300,
+        .seed = 1,
+        .format = OUTPUT_FORMAT_CSV,
+    };
+    if (!parse_args(&config, argc, argv)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    renderer_t* rend = renderer_new(config.width, config.height, "Benchmark");
+    if (rend == NULL) {
+        return 1;
+    }
+    app_t* app = app_init();
+    rend->user_ptr = app;
+    app_resize(app, ivec2(config.width, config.height));
+    app_set_bloom_pass_limit(app, config.bloom_passes);
+
+    bench_scene_t scene = bench_scene_generate(&config);
+    app_set_scene(app, &scene.scene);
+
+    // Shaders stream in on the loader thread, nothing is measured before.
+    while (app_loading(app)) {
+        frame_render(rend, app, &scene);
+    }
+    if (app_failed(app)) {
+        printf("ERROR: Failed to load the app's assets.\n");
+        return 1;
+    }
+    for (u32 i = 0; i < config.warmup_frames; i++) {
+        frame_render(rend, app, &scene);
+    }
+    glFinish();
+    gpu_timer_reset();
+
+    frame_sample_t* samples = malloc(config.frames * sizeof(frame_sample_t));
+    for (u32 i = 0; i < config.frames; i++) {
+        render_stats_reset();
+        f64 start = time_ms();
+        frame_render(rend, app, &scene);
+        samples[i] = (frame_sample_t) {
+            .cpu_ms = time_ms() - start,
+            .render = render_stats_get(),
+            .batch = batch_stats(app->batch),
+            .frame_arena_bytes = arena_pos(renderer_frame_arena(rend)),
+        };
+    }
+    // Let the timer resolve the queries of the last frames. Rendering more
+    // frames would add samples so only the query sets are cycled.
+    glFinish();
+    for (u32 i = 0; i < 4; i++) {
+        gpu_timer_frame_begin();
+        gpu_timer_frame_end();
+    }
+
+    u32 n = config.frames;
+    f32* values = malloc(8 * n * sizeof(f32));
+    for (u32 i = 0; i < n; i++) {
+        values[i] = samples[i].cpu_ms;
+        values[n + i] = samples[i].render.draw_calls;
+        values[2*n + i] = samples[i].render.state_changes;
+        values[3*n + i] = samples[i].render.state_changes_skipped;
+        values[4*n + i] = samples[i].render.uniform_updates;
+        values[5*n + i] = samples[i].batch.flushes;
+        values[6*n + i] = samples[i].batch.bytes_uploaded;
+        values[7*n + i] = samples[i].frame_arena_bytes;
+    }
+    results_t results = {
+        .cpu_ms = summarize(&values[0], n),
+        .draw_calls = summarize(&values[n], n),
+        .state_changes = summarize(&values[2*n], n),
+        .state_changes_skipped = summarize(&values[3*n], n),
+        .uniform_updates = summarize(&values[4*n], n),
+        .batch_flushes = summarize(&values[5*n], n),
+        .batch_bytes_uploaded = summarize(&values[6*n], n),
+        .frame_arena_bytes = summarize(&values[7*n], n),
+    };
+    free(values);
+    free(samples);
+
+    FILE* fp = stdout;
+    if (config.output != NULL) {
+        fp = fopen(config.output, "wb");
+        if (fp == NULL) {
+            printf("ERROR: Failed to open '%s' for writing.\n", config.output);
+            fp = stdout;
+        }
+    }
+    switch (config.format) {
+        case OUTPUT_FORMAT_CSV:
+            write_csv(fp, &results);
+            break;
+        case OUTPUT_FORMAT_JSON:
+            write_json(fp, &config, &results);
+            break;
+    }
+    if (fp != stdout) {
+        fclose(fp);
+    }
+
+    bench_scene_free(&scene);
+    app_shutdown(app);
+    renderer_free(rend);
+
+    return 0;
+}
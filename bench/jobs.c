@@ -0,0 +1,307 @@
+//
+// Micro-benchmark of the job system. Prepares a synthetic frame on the CPU
+// with 1 up to N threads and reports how the frame time scales. No GL
+// context is needed.
+//
+// A frame computes a model matrix per object, culls the lights per screen
+// tile, records one draw command per visible object into per thread command
+// buffers and sorts the merged buffer. The checksum of the sorted keys is
+// printed with every thread count and should never change.
+//
+
+#include "command_buffer.h"
+#include "core.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct jobs_config_t jobs_config_t;
+struct jobs_config_t {
+    u32 obj_count;
+    u32 light_count;
+    u32 max_threads;
+    u32 warmup_frames;
+    u32 frames;
+};
+
+static void usage(const char* program) {
+    printf(
+        "Usage: %s [options]\n"
+        "  --objects N          Number of objects (default 100000)\n"
+        "  --lights N           Number of lights (default 4096)\n"
+        "  --threads N          Highest thread count measured (default: core count)\n"
+        "  --warmup N           Frames prepared before measuring (default 10)\n"
+        "  --frames N           Measured frames per thread count (default 100)\n",
+        program);
+}
+
+static b8 parse_args(jobs_config_t* config, i32 argc, char** argv) {
+    for (i32 i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0) {
+            return false;
+        }
+        if (i + 1 == argc) {
+            printf("ERROR: Missing value for '%s'.\n", arg);
+            return false;
+        }
+        const char* value = argv[++i];
+
+        b8 valid = true;
+        if (strcmp(arg, "--objects") == 0) {
+            config->obj_count = strtoul(value, NULL, 10);
+        } else if (strcmp(arg, "--lights") == 0) {
+            config->light_count = strtoul(value, NULL, 10);
+        } else if (strcmp(arg, "--threads") == 0) {
+            config->max_threads = strtoul(value, NULL, 10);
+            valid = config->max_threads > 0 && config->max_threads <= JOB_MAX_THREADS;
+        } else if (strcmp(arg, "--warmup") == 0) {
+            config->warmup_frames = strtoul(value, NULL, 10);
+        } else if (strcmp(arg, "--frames") == 0) {
+            config->frames = strtoul(value, NULL, 10);
+            valid = config->frames > 0;
+        } else {
+            printf("ERROR: Unknown option '%s'.\n", arg);
+            return false;
+        }
+
+        if (!valid) {
+            printf("ERROR: Invalid value '%s' for '%s'.\n", value, arg);
+            return false;
+        }
+    }
+    return true;
+}
+
+// -- Synthetic frame ----------------------------------------------------------
+
+// xorshift32, same as the main benchmark.
+static u32 rng_next(u32* state) {
+    u32 x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static f32 rng_range(u32* state, f32 min, f32 max) {
+    return lerp(min, max, (f32) (rng_next(state) >> 8) / (f32) (1 << 24));
+}
+
+#define TILE_COUNT_X 16
+#define TILE_COUNT_Y 9
+#define RECORD_CHUNK 1024
+#define VIEW_EXTENT_X 8.0f
+#define VIEW_EXTENT_Y 4.5f
+
+typedef struct synth_obj_t synth_obj_t;
+struct synth_obj_t {
+    Vec3 pos;
+    Vec3 size;
+    f32 speed;
+    u32 material;
+};
+
+typedef struct synth_light_t synth_light_t;
+struct synth_light_t {
+    Vec2 pos;
+    f32 radius;
+};
+
+typedef struct synth_frame_t synth_frame_t;
+struct synth_frame_t {
+    job_system_t* js;
+    arena_t* arenas[JOB_MAX_THREADS];
+    f32 time;
+
+    synth_obj_t* objs;
+    u32 obj_count;
+    Mat4* transforms;
+
+    synth_light_t* lights;
+    u32 light_count;
+    // Lights touching each tile.
+    u32 tile_light_counts[TILE_COUNT_X * TILE_COUNT_Y];
+
+    command_buffer_t** chunks;
+    u32 chunk_count;
+};
+
+static void synth_transforms(void* user_ptr, u32 begin, u32 end, u32 thread) {
+    (void) thread;
+    synth_frame_t* frame = user_ptr;
+    for (u32 i = begin; i < end; i++) {
+        const synth_obj_t* obj = &frame->objs[i];
+        Vec3 pos = obj->pos;
+        pos.x += sinf(frame->time * obj->speed + i) * 0.5f;
+        pos.y += cosf(frame->time * obj->speed + i) * 0.5f;
+        Mat4 transform = mat4_translate(MAT4_IDENTITY, pos);
+        frame->transforms[i] = mat4_scale(transform, obj->size);
+    }
+}
+
+static void synth_cull_lights(void* user_ptr, u32 begin, u32 end, u32 thread) {
+    (void) thread;
+    synth_frame_t* frame = user_ptr;
+    const f32 tile_w = 2.0f * VIEW_EXTENT_X / TILE_COUNT_X;
+    const f32 tile_h = 2.0f * VIEW_EXTENT_Y / TILE_COUNT_Y;
+    for (u32 tile = begin; tile < end; tile++) {
+        f32 min_x = -VIEW_EXTENT_X + (tile % TILE_COUNT_X) * tile_w;
+        f32 min_y = -VIEW_EXTENT_Y + (tile / TILE_COUNT_X) * tile_h;
+        u32 count = 0;
+        for (u32 i = 0; i < frame->light_count; i++) {
+            const synth_light_t* light = &frame->lights[i];
+            f32 dx = max(max(min_x - light->pos.x, light->pos.x - (min_x + tile_w)), 0.0f);
+            f32 dy = max(max(min_y - light->pos.y, light->pos.y - (min_y + tile_h)), 0.0f);
+            count += dx*dx + dy*dy <= light->radius*light->radius;
+        }
+        frame->tile_light_counts[tile] = count;
+    }
+}
+
+static void synth_record(void* user_ptr, u32 begin, u32 end, u32 thread) {
+    synth_frame_t* frame = user_ptr;
+    for (u32 chunk = begin; chunk < end; chunk++) {
+        u32 first = chunk * RECORD_CHUNK;
+        u32 count = min(frame->obj_count - first, RECORD_CHUNK);
+        command_buffer_t* cb = command_buffer_new(frame->arenas[thread], count, count * sizeof(Mat4));
+        for (u32 i = first; i < first + count; i++) {
+            const Mat4* transform = &frame->transforms[i];
+            // The translation lives in the last vector.
+            f32 x = transform->d.x;
+            f32 y = transform->d.y;
+            if (fabsf(x) > VIEW_EXTENT_X + 1.0f || fabsf(y) > VIEW_EXTENT_Y + 1.0f) {
+                continue;
+            }
+            u32 material = frame->objs[i].material;
+            u64 key = draw_key(0, 0, material & 3, material >> 2, transform->d.z);
+            Mat4* payload = command_buffer_push(cb, key, sizeof(Mat4));
+            *payload = *transform;
+        }
+        frame->chunks[chunk] = cb;
+    }
+}
+
+// Returns a hash of the sorted keys and the tile light counts.
+static u64 synth_frame_run(synth_frame_t* frame, arena_t* frame_arena) {
+    // Popped rather than cleared, as the app does, so the measured frames
+    // don't include committing the arenas again.
+    for (u32 i = 0; i < job_system_thread_count(frame->js); i++) {
+        arena_pop_to(frame->arenas[i], 0);
+    }
+    arena_pop_to(frame_arena, 0);
+
+    parallel_for(frame->js, frame->obj_count, 1024, synth_transforms, frame);
+    parallel_for(frame->js, TILE_COUNT_X * TILE_COUNT_Y, 1, synth_cull_lights, frame);
+    parallel_for(frame->js, frame->chunk_count, 1, synth_record, frame);
+
+    command_buffer_t* cb = command_buffer_new(frame_arena, frame->obj_count, frame->obj_count * sizeof(Mat4));
+    for (u32 i = 0; i < frame->chunk_count; i++) {
+        command_buffer_append(cb, frame->chunks[i]);
+    }
+    command_buffer_sort(cb, frame->js);
+
+    u64 hash = 0xcbf29ce484222325ull;
+    for (u32 i = 0; i < cb->count; i++) {
+        hash = (hash ^ cb->commands[i].key) * 0x100000001b3ull;
+    }
+    for (u32 i = 0; i < TILE_COUNT_X * TILE_COUNT_Y; i++) {
+        hash = (hash ^ frame->tile_light_counts[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static f64 time_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (f64) ts.tv_sec * 1e3 + (f64) ts.tv_nsec * 1e-6;
+}
+
+i32 main(i32 argc, char** argv) {
+    jobs_config_t config = {
+        .obj_count = 100000,
+        .light_count = 4096,
+        .max_threads = min(cpu_count(), JOB_MAX_THREADS),
+        .warmup_frames = 10,
+        .frames = 100,
+    };
+    if (!parse_args(&config, argc, argv)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    u32 rng = 1;
+    synth_frame_t frame = {
+        .objs = malloc(config.obj_count * sizeof(synth_obj_t)),
+        .obj_count = config.obj_count,
+        .transforms = malloc(config.obj_count * sizeof(Mat4)),
+        .lights = malloc(config.light_count * sizeof(synth_light_t)),
+        .light_count = config.light_count,
+        .chunk_count = (config.obj_count + RECORD_CHUNK - 1) / RECORD_CHUNK,
+    };
+    frame.chunks = malloc(frame.chunk_count * sizeof(command_buffer_t*));
+    for (u32 i = 0; i < config.obj_count; i++) {
+        frame.objs[i] = (synth_obj_t) {
+            .pos = vec3(rng_range(&rng, -10.0f, 10.0f), rng_range(&rng, -6.0f, 6.0f), rng_range(&rng, -1.0f, 1.0f)),
+            .size = vec3(rng_range(&rng, 0.05f, 0.5f), rng_range(&rng, 0.05f, 0.5f), 1.0f),
+            .speed = rng_range(&rng, 0.5f, 2.0f),
+            .material = rng_next(&rng) & 31,
+        };
+    }
+    for (u32 i = 0; i < config.light_count; i++) {
+        frame.lights[i] = (synth_light_t) {
+            .pos = vec2(rng_range(&rng, -10.0f, 10.0f), rng_range(&rng, -6.0f, 6.0f)),
+            .radius = rng_range(&rng, 0.25f, 2.0f),
+        };
+    }
+
+    arena_t* frame_arena = arena_new(1ull << 30);
+    f32 base_ms = 0.0f;
+    printf("threads,avg_ms,min_ms,speedup,efficiency,checksum\n");
+    for (u32 threads = 1; threads <= config.max_threads; threads++) {
+        frame.js = job_system_new(threads - 1);
+        for (u32 i = 0; i < threads; i++) {
+            frame.arenas[i] = arena_new(1ull << 30);
+        }
+
+        u64 checksum = 0;
+        for (u32 i = 0; i < config.warmup_frames; i++) {
+            frame.time = i / 60.0f;
+            synth_frame_run(&frame, frame_arena);
+        }
+        f64 total_ms = 0.0;
+        f64 min_ms = 1e9;
+        for (u32 i = 0; i < config.frames; i++) {
+            frame.time = i / 60.0f;
+            f64 start = time_ms();
+            u64 hash = synth_frame_run(&frame, frame_arena);
+            f64 ms = time_ms() - start;
+            total_ms += ms;
+            min_ms = min(min_ms, ms);
+            checksum ^= hash + i;
+        }
+
+        f32 avg_ms = total_ms / config.frames;
+        if (threads == 1) {
+            base_ms = avg_ms;
+        }
+        printf("%u,%.4f,%.4f,%.3f,%.3f,%016llx\n", threads, avg_ms, min_ms,
+                base_ms / avg_ms, base_ms / avg_ms / threads, (unsigned long long) checksum);
+        fflush(stdout);
+
+        for (u32 i = 0; i < threads; i++) {
+            arena_free(frame.arenas[i]);
+        }
+        job_system_free(frame.js);
+    }
+
+    arena_free(frame_arena);
+    free(frame.chunks);
+    free(frame.lights);
+    free(frame.transforms);
+    free(frame.objs);
+    return 0;
+}
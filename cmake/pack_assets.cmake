@@ -0,0 +1,138 @@
+# Packs every file under ASSET_DIR into one archive and writes it to OUTPUT as
+# a C source file defining 'assets_pak' and 'assets_pak_size'. The format is
+# described in include/archive.h.
+#
+# Usage: cmake -DASSET_DIR=<dir> -DOUTPUT=<file.c> -P pack_assets.cmake
+
+if (NOT ASSET_DIR OR NOT OUTPUT)
+    message(FATAL_ERROR "ASSET_DIR and OUTPUT have to be set.")
+endif ()
+
+set(PAK_MAGIC 827015504) # 'PAK1'
+set(PAK_HEADER_SIZE 16)
+set(PAK_ENTRY_SIZE 16)
+set(PAK_DATA_ALIGN 16)
+
+# Hex of a u32 in little endian.
+function(u32_le VALUE OUT)
+    math(EXPR hex "${VALUE}" OUTPUT_FORMAT HEXADECIMAL)
+    string(SUBSTRING "${hex}" 2 -1 hex)
+    string(LENGTH "${hex}" len)
+    while (len LESS 8)
+        string(PREPEND hex "0")
+        math(EXPR len "${len} + 1")
+    endwhile ()
+    string(SUBSTRING "${hex}" 6 2 b0)
+    string(SUBSTRING "${hex}" 4 2 b1)
+    string(SUBSTRING "${hex}" 2 2 b2)
+    string(SUBSTRING "${hex}" 0 2 b3)
+    set(${OUT} "${b0}${b1}${b2}${b3}" PARENT_SCOPE)
+endfunction()
+
+# 32-bit FNV-1a, matches 'str_hash'.
+function(fnv1a HEX OUT)
+    set(hash 2166136261)
+    string(LENGTH "${HEX}" len)
+    set(i 0)
+    while (i LESS len)
+        string(SUBSTRING "${HEX}" ${i} 2 byte)
+        math(EXPR hash "((${hash} ^ 0x${byte}) * 16777619) & 0xffffffff")
+        math(EXPR i "${i} + 2")
+    endwhile ()
+    set(${OUT} ${hash} PARENT_SCOPE)
+endfunction()
+
+# Zero bytes padding SIZE up to ALIGN.
+function(padding SIZE ALIGN OUT)
+    math(EXPR count "(${ALIGN} - ${SIZE} % ${ALIGN}) % ${ALIGN}")
+    string(REPEAT "00" ${count} pad)
+    set(${OUT} "${pad}" PARENT_SCOPE)
+endfunction()
+
+file(GLOB_RECURSE files RELATIVE "${ASSET_DIR}" "${ASSET_DIR}/*")
+list(SORT files)
+list(LENGTH files entry_count)
+
+# Power of two with at least twice as many slots as entries.
+set(table_capacity 1)
+math(EXPR min_capacity "${entry_count} * 2")
+while (table_capacity LESS min_capacity)
+    math(EXPR table_capacity "${table_capacity} * 2")
+endwhile ()
+
+# Blobs follow the table. Every name and file is NUL terminated.
+math(EXPR offset "${PAK_HEADER_SIZE} + ${table_capacity} * ${PAK_ENTRY_SIZE}")
+set(blobs "")
+# Entries in table order, '-' marks an empty slot.
+set(slot_entries "")
+foreach (i RANGE 1 ${table_capacity})
+    list(APPEND slot_entries "-")
+endforeach ()
+
+foreach (name ${files})
+    string(HEX "${name}" name_hex)
+    fnv1a("${name_hex}" hash)
+    file(READ "${ASSET_DIR}/${name}" data_hex HEX)
+    string(LENGTH "${data_hex}" data_hex_len)
+    math(EXPR data_size "${data_hex_len} / 2")
+    string(LENGTH "${name_hex}" name_hex_len)
+
+    set(name_offset ${offset})
+    math(EXPR offset "${offset} + ${name_hex_len} / 2 + 1")
+    padding(${offset} ${PAK_DATA_ALIGN} pad)
+    string(APPEND blobs "${name_hex}00${pad}")
+    math(EXPR offset "${offset} + ${PAK_DATA_ALIGN} - 1 - (${offset} + ${PAK_DATA_ALIGN} - 1) % ${PAK_DATA_ALIGN}")
+
+    set(data_offset ${offset})
+    math(EXPR offset "${offset} + ${data_size} + 1")
+    padding(${offset} ${PAK_DATA_ALIGN} pad)
+    string(APPEND blobs "${data_hex}00${pad}")
+    math(EXPR offset "${offset} + ${PAK_DATA_ALIGN} - 1 - (${offset} + ${PAK_DATA_ALIGN} - 1) % ${PAK_DATA_ALIGN}")
+
+    u32_le(${hash} hash_le)
+    u32_le(${name_offset} name_offset_le)
+    u32_le(${data_offset} data_offset_le)
+    u32_le(${data_size} data_size_le)
+
+    # Linear probing, same as the lookup.
+    math(EXPR slot "${hash} & (${table_capacity} - 1)")
+    list(GET slot_entries ${slot} taken)
+    while (NOT taken STREQUAL "-")
+        math(EXPR slot "(${slot} + 1) & (${table_capacity} - 1)")
+        list(GET slot_entries ${slot} taken)
+    endwhile ()
+    list(REMOVE_AT slot_entries ${slot})
+    list(INSERT slot_entries ${slot} "${hash_le}${name_offset_le}${data_offset_le}${data_size_le}")
+endforeach ()
+
+u32_le(${PAK_MAGIC} magic_le)
+u32_le(${entry_count} entry_count_le)
+u32_le(${table_capacity} table_capacity_le)
+set(archive "${magic_le}${entry_count_le}${table_capacity_le}00000000")
+string(REPEAT "00" ${PAK_ENTRY_SIZE} empty_entry)
+foreach (entry ${slot_entries})
+    if (entry STREQUAL "-")
+        string(APPEND archive "${empty_entry}")
+    else ()
+        string(APPEND archive "${entry}")
+    endif ()
+endforeach ()
+string(APPEND archive "${blobs}")
+
+string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${archive}")
+# Keep lines reasonably short. CMake regexes have no repetition counts.
+string(REPEAT "0x..," 16 line)
+string(REGEX REPLACE "(${line})" "\\1\n    " bytes "${bytes}")
+string(STRIP "${bytes}" bytes)
+
+file(WRITE "${OUTPUT}"
+"// Generated by pack_assets.cmake. Do not edit.
+
+#include \"archive.h\"
+
+__attribute__((aligned(16)))
+const u8 assets_pak[] = {
+    ${bytes}
+};
+const u64 assets_pak_size = sizeof(assets_pak);
+")
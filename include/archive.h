@@ -0,0 +1,42 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include "core.h"
+
+// -- Archive ------------------------------------------------------------------
+// Read only pack of named files, looked up in O(1) by name hash. Archives are
+// produced at build time by 'cmake/pack_assets.cmake' and opened straight
+// from memory, either embedded into the executable or a mapped file.
+//
+// Layout, all integers are little endian u32:
+//   Header: magic 'PAK1', entry count, table capacity, reserved.
+//   Table:  'table capacity' slots of name hash (str_hash), name offset,
+//           data offset and data size. The capacity is a power of two and
+//           collisions are resolved with linear probing. Empty slots are
+//           all zero.
+//   Blobs:  NUL terminated names and file contents, 16 byte aligned.
+// Offsets are from the start of the archive.
+
+#define ARCHIVE_MAGIC 0x314b4150
+
+typedef struct archive_t archive_t;
+struct archive_t {
+    const u8* data;
+    u64 size;
+    u32 entry_count;
+    u32 table_capacity;
+    b8 valid;
+};
+
+// The data has to outlive the archive. Returns an invalid archive if the data
+// isn't one.
+extern archive_t archive_open(const u8* data, u64 size);
+// Returns the contents of the file, which are followed by a NUL terminator.
+// Returns an empty string with NULL data if there's no such file.
+extern str_t archive_find(const archive_t* archive, str_t name);
+
+// Every file under 'assets', embedded by the build.
+extern const u8 assets_pak[];
+extern const u64 assets_pak_size;
+
+#endif // ARCHIVE_H
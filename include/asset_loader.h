@@ -0,0 +1,38 @@
+#ifndef ASSET_LOADER_H
+#define ASSET_LOADER_H
+
+#include "archive.h"
+#include "core.h"
+
+// -- Asset loader -------------------------------------------------------------
+// Loads assets on a background thread. Requests go to the worker and finished
+// loads come back through lock-free single producer, single consumer queues.
+// Callbacks run inside 'asset_loader_poll' on the thread owning the loader,
+// so GL objects can be created in them.
+//
+// Without a worker and when too many loads are in flight, the asset is loaded
+// synchronously and the callback runs inside the request. The web build has
+// no worker since it's built without pthreads, so there every load is
+// synchronous.
+//
+// The loader is meant for the assets loaded at startup. Contents read from
+// disk are never freed before the loader is, so streaming assets in and out
+// over the life of the app would grow its memory without bound.
+
+typedef void (*asset_loaded_callback_t)(void* user_ptr, str_t name, str_t content, b8 success);
+
+typedef struct asset_loader_t asset_loader_t;
+
+// Assets are looked up in 'archive' first, which may be NULL, and otherwise
+// read from '<root>/<name>'. Contents stay valid until the loader is freed.
+extern asset_loader_t* asset_loader_new(const archive_t* archive, const char* root);
+// Waits for the load in progress and drops all others.
+extern void asset_loader_free(asset_loader_t* loader);
+
+// 'name' has to stay alive until the callback has run.
+extern void asset_loader_request(asset_loader_t* loader, str_t name, asset_loaded_callback_t callback, void* user_ptr);
+// Runs the callbacks of every finished load. Returns the number of loads
+// still in flight.
+extern u32 asset_loader_poll(asset_loader_t* loader);
+
+#endif // ASSET_LOADER_H
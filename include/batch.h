@@ -0,0 +1,55 @@
+//
+// Batch renderer for instanced quads. Per quad instance data is collected on
+// the CPU and appended to a single streamed vertex buffer, which is orphaned
+// at the start of every frame and whenever it fills up. The batch is flushed
+// whenever the shader or texture changes, or when the staging area is full.
+//
+// The quad vertices only carry a 0 to 1 uv across the quad. Anything that
+// varies per quad, such as a sprite's region of an atlas, is up to the
+// caller: put it in the instance layout and apply it in the shader.
+//
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "core.h"
+#include "render_api.h"
+
+typedef struct batch_desc_t batch_desc_t;
+struct batch_desc_t {
+    // Number of quads staged before the batch is flushed. The stream buffer
+    // holds 'capacity' quads as well.
+    u32 capacity;
+    // Layout of the instance data of a quad. Its attributes follow the
+    // position and uv of the quad vertices, at locations 0 and 1. The
+    // attribute array needs to stay alive as long as the batch.
+    vertex_layout_t instance_layout;
+};
+
+typedef struct batch_stats_t batch_stats_t;
+struct batch_stats_t {
+    u32 quads;
+    u32 flushes;
+    u32 bytes_uploaded;
+};
+
+typedef struct batch_t batch_t;
+
+extern batch_t* batch_new(arena_t* arena, batch_desc_t desc);
+extern void batch_free(batch_t* batch);
+
+// Orphans the stream buffer and resets the stats. Call once at the start of
+// every frame.
+extern void batch_frame_begin(batch_t* batch);
+extern batch_stats_t batch_stats(const batch_t* batch);
+
+// The shader reads the instance attributes of the layout. Uniforms and
+// samplers are left to the caller, the texture is bound to unit 0.
+extern void batch_set_shader(batch_t* batch, shader_t shader);
+extern void batch_set_texture(batch_t* batch, texture_t texture);
+
+// Copies one quad's instance data, 'instance_layout.stride' bytes.
+extern void batch_quad(batch_t* batch, const void* instance);
+extern void batch_flush(batch_t* batch);
+
+#endif // BATCH_H
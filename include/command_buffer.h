@@ -0,0 +1,83 @@
+//
+// Command buffer for deferred draw submission. Draws are recorded as plain
+// data with a 64-bit sort key and a small payload, sorted by key and then
+// replayed by the caller. Recording never touches GL, so a buffer can be
+// filled from any thread, and only allocates from the arena it lives on. A
+// buffer and its arena must only be used by one thread at a time.
+//
+
+#ifndef COMMAND_BUFFER_H
+#define COMMAND_BUFFER_H
+
+#include "core.h"
+
+// Sort key layout, most significant first:
+//   pass     8 bits
+//   pipeline 8 bits
+//   shader   8 bits
+//   texture  8 bits
+//   depth   32 bits
+// Pass, pipeline, shader and texture are small ids chosen by the caller.
+// Sorting groups draws by pass and then by state, so replaying them only
+// changes state between groups. Within a group draws go from low to high
+// depth and keep their recording order on ties.
+
+#define DRAW_KEY_PASS_SHIFT 56
+#define DRAW_KEY_PIPELINE_SHIFT 48
+#define DRAW_KEY_SHADER_SHIFT 40
+#define DRAW_KEY_TEXTURE_SHIFT 32
+
+extern u64 draw_key(u8 pass, u8 pipeline, u8 shader, u8 texture, f32 depth);
+// Draws with the same state part of their key can be merged into one.
+#define draw_key_state(KEY) ((KEY) >> DRAW_KEY_TEXTURE_SHIFT)
+#define draw_key_pass(KEY) ((u8) ((KEY) >> DRAW_KEY_PASS_SHIFT))
+#define draw_key_pipeline(KEY) ((u8) ((KEY) >> DRAW_KEY_PIPELINE_SHIFT))
+#define draw_key_shader(KEY) ((u8) ((KEY) >> DRAW_KEY_SHADER_SHIFT))
+#define draw_key_texture(KEY) ((u8) ((KEY) >> DRAW_KEY_TEXTURE_SHIFT))
+
+typedef struct draw_command_t draw_command_t;
+struct draw_command_t {
+    u64 key;
+    // Of the payload within the buffer's data.
+    u32 offset;
+    u32 size;
+};
+
+typedef struct command_buffer_t command_buffer_t;
+struct command_buffer_t {
+    arena_t* arena;
+    draw_command_t* commands;
+    u32 count;
+    u32 capacity;
+    // Payloads in recording order.
+    u8* data;
+    u32 data_size;
+    u32 data_capacity;
+};
+
+// Allocates the buffer on 'arena' with room for 'capacity' commands and
+// 'data_capacity' bytes of payload. Both grow on the arena when exceeded.
+extern command_buffer_t* command_buffer_new(arena_t* arena, u32 capacity, u32 data_capacity);
+extern void command_buffer_clear(command_buffer_t* cb);
+
+// Records a command and returns its payload of 'size' bytes to be filled in.
+extern void* command_buffer_push(command_buffer_t* cb, u64 key, u32 size);
+// Appends the commands of 'src' after those of 'dst', copying their
+// payloads. Used to merge buffers recorded on different threads in a fixed
+// order, so the merged buffer doesn't depend on which thread recorded what.
+extern void command_buffer_append(command_buffer_t* dst, const command_buffer_t* src);
+// Stable LSD radix sort on the keys. Byte positions shared by every key are
+// skipped, so sorting only costs a pass per byte which actually differs.
+// Large buffers are sorted in blocks on 'js', which may be NULL to sort on
+// the calling thread. The result is the same either way.
+extern void command_buffer_sort(command_buffer_t* cb, job_system_t* js);
+
+static inline const void* command_payload(const command_buffer_t* cb, const draw_command_t* cmd) {
+    return cb->data + cmd->offset;
+}
+
+// Finds the commands of 'pass' in a sorted buffer. Returns their count and
+// stores the index of the first one in 'first'.
+extern u32 command_buffer_pass(const command_buffer_t* cb, u8 pass, u32* first);
+
+#endif // COMMAND_BUFFER_H
@@ -29,24 +29,93 @@ typedef u32 b32;
 #define false ((b8) 0)
 #endif // false
 
+// C99 has no keyword for thread local storage.
+#ifndef thread_local
+#define thread_local __thread
+#endif // thread_local
+
 #define arr_len(ARR) (sizeof(ARR) / sizeof((ARR)[0]))
 #define offset(S, M) ((u64) &(((S*) 0)->M))
 
 // -- Arena --------------------------------------------------------------------
 // Linear allocator
+//
+// The capacity is reserved address space and memory is only committed as the
+// arena grows, so arenas can be sized generously. Without virtual memory
+// (Emscripten) memory is malloc'd in blocks on demand instead and the capacity
+// isn't a limit.
+// Running out of capacity is a fatal error.
 
 typedef struct arena_t arena_t;
 
-extern arena_t* arena_new(u32 capacity);
+// Alignment of 'arena_push'.
+#define ARENA_DEFAULT_ALIGN 16
+
+extern arena_t* arena_new(u64 capacity);
 extern void arena_free(arena_t* arena);
 
-extern void* arena_push(arena_t* arena, u32 size);
-extern void arena_pop(arena_t* arena, u32 size);
+extern void* arena_push(arena_t* arena, u64 size);
+// 'align' has to be a power of two.
+extern void* arena_push_aligned(arena_t* arena, u64 size, u64 align);
+extern void arena_pop(arena_t* arena, u64 size);
+// Also gives memory above a threshold back to the OS.
 extern void arena_clear(arena_t* arena);
+extern u64 arena_pos(const arena_t* arena);
+extern void arena_pop_to(arena_t* arena, u64 pos);
 
 #define arena_push_type(ARENA, T) arena_push((ARENA), sizeof(T))
 #define arena_push_array(ARENA, T, COUNT) arena_push((ARENA), sizeof(T)*(COUNT))
 
+// Temporary allocations. Everything pushed between begin and end is freed by
+// 'arena_temp_end'.
+typedef struct arena_temp_t arena_temp_t;
+struct arena_temp_t {
+    arena_t* arena;
+    u64 pos;
+};
+
+extern arena_temp_t arena_temp_begin(arena_t* arena);
+extern void arena_temp_end(arena_temp_t temp);
+
+// Allocation accounting. Usage, peak and push counts are always tracked.
+// Per tag stats are only gathered with ARENA_STATS_ENABLED defined.
+
+#define ARENA_MAX_TAGS 16
+
+typedef struct arena_tag_stats_t arena_tag_stats_t;
+struct arena_tag_stats_t {
+    const char* name;
+    // Bytes pushed with the tag, including padding and popped allocations.
+    u64 bytes;
+    u64 push_count;
+};
+
+typedef struct arena_stats_t arena_stats_t;
+struct arena_stats_t {
+    u64 used;
+    u64 peak;
+    u64 committed;
+    u64 capacity;
+    u64 push_count;
+    // The first tag is "untagged".
+    arena_tag_stats_t tags[ARENA_MAX_TAGS];
+    u32 tag_count;
+};
+
+// Attributes all following pushes to 'tag' until another tag is set. The
+// string has to outlive the arena. Returns the previous tag so it can be
+// restored.
+extern const char* arena_set_tag(arena_t* arena, const char* tag);
+extern arena_stats_t arena_stats(const arena_t* arena);
+// Prints the stats of the arena.
+extern void arena_report(const arena_t* arena, const char* name);
+
+// Returns a temporary scope on a thread local scratch arena. The scratch arena
+// is never one of 'conflicts', which should hold every arena the caller
+// allocates its results in. Otherwise releasing the scratch could free them.
+extern arena_temp_t arena_scratch(arena_t* const* conflicts, u32 conflict_count);
+#define arena_scratch_release(TEMP) arena_temp_end(TEMP)
+
 // -- String -------------------------------------------------------------------
 // Length based strings.
 
@@ -65,7 +134,97 @@ extern str_t str(const u8* data, u32 len);
 #define str_arg(STR) (i32) (STR).len, (STR).data
 
 extern const char* str_to_cstr(arena_t* arena, str_t str);
+// Copies the whole file into the arena. Returns an empty string and leaves
+// the arena untouched on failure.
 extern str_t str_read_file(arena_t* arena, str_t filename);
+// 32-bit FNV-1a hash of the string contents.
+extern u32 str_hash(str_t str);
+// 64-bit FNV-1a, for keys where a collision would go unnoticed.
+extern u64 str_hash64(str_t str);
+
+// -- File ---------------------------------------------------------------------
+// Read only views of whole files without copying them.
+
+typedef struct file_map_t file_map_t;
+struct file_map_t {
+    str_t content;
+    b8 valid;
+
+    // Internal
+    // Whether 'content' is a memory mapping or a malloc'd buffer.
+    b8 mapped;
+};
+
+// Memory maps the file. Falls back to reading it into a buffer where mapping
+// isn't possible, like Emscripten's virtual file system. 'content' stays valid
+// until 'file_unmap'. On failure 'valid' is false.
+extern file_map_t file_map(str_t filename);
+extern void file_unmap(file_map_t* map);
+
+// -- Threads ------------------------------------------------------------------
+// Thin wrappers around pthreads. Emscripten builds without pthread support
+// can't start threads, 'thread_create' returns NULL there.
+
+typedef struct thread_t thread_t;
+typedef void (*thread_func_t)(void* arg);
+
+// Returns NULL if the thread couldn't be started.
+extern thread_t* thread_create(thread_func_t func, void* arg);
+// Waits for the thread to finish and frees it.
+extern void thread_join(thread_t* thread);
+
+// Counting semaphore.
+typedef struct semaphore_t semaphore_t;
+
+extern semaphore_t* semaphore_new(u32 count);
+extern void semaphore_free(semaphore_t* semaphore);
+extern void semaphore_wait(semaphore_t* semaphore);
+extern void semaphore_post(semaphore_t* semaphore);
+
+// Number of online CPU cores, at least 1.
+extern u32 cpu_count(void);
+
+// -- Jobs ---------------------------------------------------------------------
+// Work stealing job system. Every thread owns a deque of jobs: it pushes and
+// pops at the bottom while idle threads steal from the top of the others.
+// Jobs may submit more jobs, which land on the deque of the thread running
+// them. Completion is tracked with counters: submitting a job increments its
+// counter, finishing it decrements it, and waiting on a counter runs other
+// jobs until it reaches zero. A job which waits on the counter of the jobs it
+// submitted acts as their parent.
+//
+// The thread which created the system is thread 0 and the only thread apart
+// from the workers which may submit or wait.
+
+#define JOB_MAX_THREADS 32
+// Jobs a deque holds. Submitting to a full deque runs the job right away.
+#define JOB_DEQUE_SIZE 4096
+
+typedef struct job_system_t job_system_t;
+
+typedef struct job_counter_t job_counter_t;
+struct job_counter_t {
+    u32 pending;
+};
+
+// 'thread' is below 'job_system_thread_count' and can index per thread data.
+typedef void (*job_func_t)(void* user_ptr, u32 thread);
+// Processes the indices [begin, end).
+typedef void (*job_range_func_t)(void* user_ptr, u32 begin, u32 end, u32 thread);
+
+// Starts 'worker_count' workers. With 0 workers, or where threads can't be
+// started, every job runs on thread 0 while it waits.
+extern job_system_t* job_system_new(u32 worker_count);
+extern void job_system_free(job_system_t* js);
+// Workers plus thread 0.
+extern u32 job_system_thread_count(const job_system_t* js);
+
+extern void job_submit(job_system_t* js, job_func_t func, void* user_ptr, job_counter_t* counter);
+extern void job_wait(job_system_t* js, job_counter_t* counter);
+// Runs 'func' over [0, count) in ranges of at most 'grain' indices and waits
+// for all of them. Ranges are split in halves as they're stolen, so idle
+// threads take large pieces first.
+extern void parallel_for(job_system_t* js, u32 count, u32 grain, job_range_func_t func, void* user_ptr);
 
 // -- Math -----------------------------------------------------------
 
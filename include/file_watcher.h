@@ -0,0 +1,38 @@
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+#include "core.h"
+
+// -- File watcher -------------------------------------------------------------
+// Reports files written in a directory. Uses inotify on Linux and otherwise
+// compares modification times every FILE_WATCHER_POLL_INTERVAL_MS. Not
+// recursive.
+
+#define FILE_WATCHER_POLL_INTERVAL_MS 50.0
+// Files tracked by the polling fallback and changes reported per poll.
+#define FILE_WATCHER_MAX_FILES 64
+
+typedef struct file_change_t file_change_t;
+struct file_change_t {
+    // Relative to the watched directory.
+    str_t name;
+    // Milliseconds between the last write and its detection.
+    f64 age_ms;
+};
+
+typedef struct file_change_list_t file_change_list_t;
+struct file_change_list_t {
+    file_change_t* changes;
+    u32 count;
+};
+
+typedef struct file_watcher_t file_watcher_t;
+
+// Returns NULL if the directory can't be watched.
+extern file_watcher_t* file_watcher_new(const char* dir);
+extern void file_watcher_free(file_watcher_t* watcher);
+// Files changed since the last poll, each listed once and pushed onto 'arena'.
+// Never blocks.
+extern file_change_list_t file_watcher_poll(file_watcher_t* watcher, arena_t* arena);
+
+#endif // FILE_WATCHER_H
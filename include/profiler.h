@@ -0,0 +1,39 @@
+//
+// CPU profiler. Zones are recorded per thread into lock free buffers and the
+// last frames can be dumped as Chrome trace JSON, viewable in chrome://tracing
+// or https://ui.perfetto.dev.
+//
+// Zones are only recorded when compiled with 'PROFILER_ENABLED'. Otherwise the
+// macros expand to nothing.
+//
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "core.h"
+
+#ifdef PROFILER_ENABLED
+#define PROFILE_BEGIN(NAME) profiler_begin(NAME)
+#define PROFILE_END() profiler_end()
+// Returning or breaking out of the scope skips the end of the zone.
+#define PROFILE_SCOPE(NAME) \
+    for (b8 _p_ = (profiler_begin(NAME), false); !_p_; _p_ = true, profiler_end())
+#define PROFILE_FRAME() profiler_frame_mark()
+#else
+#define PROFILE_BEGIN(NAME)
+#define PROFILE_END()
+#define PROFILE_SCOPE(NAME)
+#define PROFILE_FRAME()
+#endif // PROFILER_ENABLED
+
+// The name has to outlive the profiler. Use string literals.
+extern void profiler_begin(const char* name);
+extern void profiler_end(void);
+// Marks the start of a new frame.
+extern void profiler_frame_mark(void);
+
+// Writes the zones of the last 'frame_count' frames of every thread. Threads
+// should be idle while dumping.
+extern b8 profiler_dump(const char* filename, u32 frame_count);
+
+#endif // PROFILER_H
@@ -1,9 +1,17 @@
 #ifndef PROGRAM_H
 #define PROGRAM_H
 
+#include "archive.h"
+#include "asset_loader.h"
+#include "batch.h"
 #include "core.h"
+#include "file_watcher.h"
 #include "render_api.h"
 
+// Frames the CPU may record ahead of the GPU. Transient per frame data is
+// buffered this many times so it's never overwritten while still in use.
+#define RENDERER_FRAMES_IN_FLIGHT 3
+
 typedef struct renderer_t renderer_t;
 
 typedef void (*resize_callback_t)(renderer_t* renderer, i32 width, i32 height);
@@ -19,8 +27,16 @@ struct renderer_t {
 
     // Internal data
     void* data;
+
+    // One arena per frame in flight. Only cleared when their frame comes
+    // around again.
+    arena_t* frame_arenas[RENDERER_FRAMES_IN_FLIGHT];
+    u64 frame_index;
+    // Peak bytes pushed onto a frame arena in one frame.
+    u64 frame_arena_high_water;
 };
 
+// Returns NULL if the platform fails to create a GL context.
 extern renderer_t* renderer_new(u32 width, u32 height, const char *title);
 extern void renderer_free(renderer_t* renderer);
 extern void renderer_swap_buffers(renderer_t* renderer);
@@ -28,8 +44,74 @@ extern void renderer_run(renderer_t* renderer);
 
 extern f32 get_time(void);
 
+// Platform independent part of the renderer, used by the platform layers.
+extern void renderer_frames_init(renderer_t* renderer);
+extern void renderer_frames_free(renderer_t* renderer);
+// Called before every 'update_cb'. Resets the frame arena of the new frame.
+extern void renderer_frame_begin(renderer_t* renderer);
+// Arena for transient data of the current frame, such as draw lists,
+// instance data and uniform staging. Everything on it is dropped once the
+// frame slot is reused, RENDERER_FRAMES_IN_FLIGHT frames later.
+extern arena_t* renderer_frame_arena(renderer_t* renderer);
+extern u64 renderer_frame_arena_high_water(const renderer_t* renderer);
+
 // -- App ----------------------------------------------------------------------
 
+typedef struct light_t light_t;
+struct light_t {
+    Vec3 pos;
+    Vec3 size;
+    color_t color;
+    f32 intensity;
+};
+
+typedef struct obj_t obj_t;
+struct obj_t {
+    Vec3 pos;
+    Vec3 size;
+    color_t color;
+};
+
+// Objects and lights drawn by the app. Without a scene the app draws its
+// built-in demo scene.
+typedef struct scene_t scene_t;
+struct scene_t {
+    const obj_t* objs;
+    u32 obj_count;
+    const light_t* lights;
+    u32 light_count;
+};
+
+// Per instance data of the object and light passes.
+typedef struct instance_t instance_t;
+struct instance_t {
+    Vec3 pos;
+    Vec3 size;
+    color_t color;
+    f32 intensity;
+};
+
+// Binding points of the uniform blocks shared by the shaders.
+typedef enum uniform_binding_t {
+    UNIFORM_BINDING_FRAME,
+    UNIFORM_BINDING_DRAW,
+} uniform_binding_t;
+
+// std140 mirror of the 'frame_constants' block in frame.glsl.
+typedef struct frame_constants_t frame_constants_t;
+struct frame_constants_t {
+    Mat4 proj;
+    Vec4 ambient_color;
+    f32 time;
+    f32 _pad[3];
+};
+
+// std140 mirror of the 'draw_constants' block in vert.glsl.
+typedef struct draw_constants_t draw_constants_t;
+struct draw_constants_t {
+    Mat4 transform;
+};
+
 typedef struct Quad Quad;
 struct Quad {
     vertex_buffer_t vb;
@@ -53,16 +135,89 @@ struct post_processing_t {
         shader_t upsample_shader;
 
         u32 pass_count;
+        // Upper limit of 'pass_count'. Never larger than 'max_pass_count'.
+        u32 pass_limit;
         u32 max_pass_count;
     } bloom;
 };
 
+// Shader sources streamed in by the asset loader.
+typedef enum shader_source_t {
+    SHADER_SOURCE_VERT,
+    SHADER_SOURCE_INSTANCE_VERT,
+    SHADER_SOURCE_OBJ_FRAG,
+    SHADER_SOURCE_LIGHT_FRAG,
+    SHADER_SOURCE_SCREEN_FRAG,
+    SHADER_SOURCE_COLOR_CORRECTION_FRAG,
+    SHADER_SOURCE_BLOOM_FRAG,
+    // Only included by other sources.
+    SHADER_SOURCE_SAMPLING,
+    SHADER_SOURCE_FRAME,
+
+    SHADER_SOURCE_COUNT,
+} shader_source_t;
+
+// Compile time features of a shader variant. Every set bit is defined in both
+// stages, so unused paths are removed by the compiler instead of branching on
+// a uniform.
+typedef enum shader_feature_t {
+    SHADER_FEATURE_BLOOM_UPSAMPLE = 1 << 0,
+} shader_feature_t;
+
+#define APP_MAX_SHADER_VARIANTS 32
+
 typedef struct app_t app_t;
+
+// User data of a shader source load, so the callback knows which source it
+// got without looking it up by name.
+typedef struct shader_source_request_t shader_source_request_t;
+struct shader_source_request_t {
+    app_t* app;
+    shader_source_t source;
+};
+
+// A program is identified by its sources and feature bits.
+typedef struct shader_variant_t shader_variant_t;
+struct shader_variant_t {
+    shader_source_t vert;
+    shader_source_t frag;
+    u32 features;
+    shader_t shader;
+};
+
 struct app_t {
     arena_t* arena;
     Ivec2 size;
+    archive_t assets;
+
+    asset_loader_t* loader;
+    str_t shader_sources[SHADER_SOURCE_COUNT];
+    shader_source_request_t shader_source_requests[SHADER_SOURCE_COUNT];
+    u32 shader_sources_pending;
+    // Sources which failed to load. The shaders are never created then.
+    u32 shader_sources_failed;
+    // Every variant compiled so far.
+    shader_variant_t shader_variants[APP_MAX_SHADER_VARIANTS];
+    u32 shader_variant_count;
+    // Set once every shader finished compiling. Until then only placeholder
+    // frames are drawn.
+    b8 shaders_ready;
+    // Watches the shader sources in the source tree. NULL unless built with
+    // SHADER_HOT_RELOAD_ENABLED.
+    file_watcher_t* shader_watcher;
+
+    const scene_t* scene;
+    // Culls, records and sorts the scene's draws in parallel. Every thread
+    // records into its own arena.
+    job_system_t* jobs;
+    arena_t* record_arenas[JOB_MAX_THREADS];
+
+    // Frame and draw constants of the uniform blocks.
+    uniform_ring_t uniforms;
 
     Quad quad;
+    // Streams the instances of the object and light passes.
+    batch_t* batch;
     shader_t obj_shader;
     shader_t light_shader;
     shader_t screen_shader;
@@ -86,6 +241,17 @@ struct app_t {
 extern app_t* app_init(void);
 extern void app_shutdown(app_t* app);
 extern void app_resize(app_t* app, Ivec2 size);
-extern void app_update(app_t* app);
+// 'frame_arena' holds the transient data of this frame.
+extern void app_update(app_t* app, arena_t* frame_arena);
+// The scene must stay alive until it's replaced. Pass NULL to go back to the
+// demo scene.
+extern void app_set_scene(app_t* app, const scene_t* scene);
+// Limits the number of bloom down- and upsample passes.
+extern void app_set_bloom_pass_limit(app_t* app, u32 limit);
+// True while assets are still streaming in. False once loading failed.
+extern b8 app_loading(const app_t* app);
+// True if an asset failed to load. The app only draws placeholder frames
+// then.
+extern b8 app_failed(const app_t* app);
 
 #endif // PROGRAM_H
@@ -45,9 +45,15 @@ typedef struct vertex_buffer_t vertex_buffer_t;
 struct vertex_buffer_t {
     u32 handle;
     u32 size;
+    buffer_usage_t usage;
 };
 
 extern vertex_buffer_t vertex_buffer_create(const void* data, u32 size, buffer_usage_t usage);
+// Replaces the whole contents of the buffer. The size may differ from the
+// previous size. Meant for buffers created with 'BUFFER_USAGE_STREAM'.
+extern void vertex_buffer_set_data(vertex_buffer_t* buffer, const void* data, u32 size);
+// Overwrites part of the buffer without reallocating it.
+extern void vertex_buffer_sub_data(vertex_buffer_t buffer, u32 offset, const void* data, u32 size);
 extern void vertex_buffer_destroy(vertex_buffer_t buffer);
 extern void vertex_buffer_bind(vertex_buffer_t buffer);
 extern void vertex_buffer_unbind(void);
@@ -65,17 +71,195 @@ extern void index_buffer_destroy(index_buffer_t buffer);
 extern void index_buffer_bind(index_buffer_t buffer);
 extern void index_buffer_unbind(void);
 
+// -- Uniform buffer -----------------------------------------------------------
+// Blocks are declared 'layout (std140)' so their layout is known up front and
+// the C struct mirroring one is copied in as is. In std140 a scalar takes 4
+// bytes, a vec2 8, a vec3 or vec4 16 and a mat4 four vec4 columns in the order
+// 'uniform_set_mat4' uploads them. Every array element is padded to 16 bytes.
+
+// A vec3 followed by a scalar shares its 16 bytes. Use these where it doesn't.
+typedef struct std140_vec3_t std140_vec3_t;
+struct std140_vec3_t {
+    Vec3 value;
+    f32 _pad;
+};
+
+// Element of a float array.
+typedef struct std140_f32_t std140_f32_t;
+struct std140_f32_t {
+    f32 value;
+    f32 _pad[3];
+};
+
+typedef struct uniform_buffer_t uniform_buffer_t;
+struct uniform_buffer_t {
+    u32 handle;
+    u32 size;
+    buffer_usage_t usage;
+};
+
+extern uniform_buffer_t uniform_buffer_create(const void* data, u32 size, buffer_usage_t usage);
+// Replaces the whole contents of the buffer. The size may differ from the
+// previous size.
+extern void uniform_buffer_set_data(uniform_buffer_t* buffer, const void* data, u32 size);
+// Overwrites part of the buffer without reallocating it.
+extern void uniform_buffer_sub_data(uniform_buffer_t buffer, u32 offset, const void* data, u32 size);
+extern void uniform_buffer_destroy(uniform_buffer_t buffer);
+// Makes 'size' bytes starting at 'offset' the source of the blocks assigned
+// to 'binding'. The offset must be a multiple of
+// 'uniform_buffer_offset_alignment'.
+extern void uniform_buffer_bind_range(uniform_buffer_t buffer, u32 binding, u32 offset, u32 size);
+extern u32 uniform_buffer_offset_alignment(void);
+
+// Binding points below this are tracked by the state cache. GL guarantees at
+// least 24.
+#define UNIFORM_BINDING_MAX 16
+
+// -- Uniform ring -------------------------------------------------------------
+// Allocator for uniform data which only lives for one frame. Each frame in
+// flight has its own buffer so data still read by the GPU is never
+// overwritten. Pushes are gathered on the CPU and uploaded in one go when a
+// range is bound, so a frame's worth of blocks costs a handful of uploads
+// instead of a glUniform call per value and draw.
+
+#define UNIFORM_RING_SIZE 3
+
+// Part of the ring's current frame. Invalid after the next frame begins.
+typedef struct uniform_range_t uniform_range_t;
+struct uniform_range_t {
+    u32 offset;
+    u32 size;
+};
+
+typedef struct uniform_ring_t uniform_ring_t;
+struct uniform_ring_t {
+    uniform_buffer_t buffers[UNIFORM_RING_SIZE];
+    u32 index;
+    // CPU copy of the current frame. Grows when a frame pushes more than fits.
+    u8* staging;
+    u32 capacity;
+    u32 offset;
+    // Bytes of the staging copy already in the buffer.
+    u32 uploaded;
+    u32 alignment;
+};
+
+extern uniform_ring_t uniform_ring_create(u32 capacity);
+extern void uniform_ring_destroy(uniform_ring_t* ring);
+// Call once per frame before pushing. Drops everything pushed before.
+extern void uniform_ring_frame_begin(uniform_ring_t* ring);
+// Copies 'data' into the current frame.
+extern uniform_range_t uniform_ring_push(uniform_ring_t* ring, const void* data, u32 size);
+// Uploads everything pushed since the last bind and binds the range.
+extern void uniform_ring_bind(uniform_ring_t* ring, uniform_range_t range, u32 binding);
+
 // -- Shader -------------------------------------------------------------------
 
+// Reflection data gathered when the program is linked and the compile status.
+// Opaque to the user.
+typedef struct shader_info_t shader_info_t;
+
+typedef enum shader_status_t {
+    SHADER_STATUS_PENDING,
+    SHADER_STATUS_READY,
+    SHADER_STATUS_FAILED,
+} shader_status_t;
+
 typedef struct shader_t shader_t;
 struct shader_t {
     u32 handle;
+    // Shared between all copies of the shader and freed by 'shader_destroy'.
+    shader_info_t* info;
 };
 
+// Resolved uniform location. Look it up once with 'shader_uniform' and keep it
+// around so setting the uniform never touches a string.
+typedef struct uniform_t uniform_t;
+struct uniform_t {
+    i32 location;
+};
+
+typedef enum shader_stage_type_t {
+    SHADER_STAGE_VERTEX,
+    SHADER_STAGE_FRAGMENT,
+} shader_stage_type_t;
+
+// Compiled shader object. Owned by the stage cache.
+typedef struct shader_stage_t shader_stage_t;
+struct shader_stage_t {
+    u32 handle;
+};
+
+// Compiled stages are cached by type and 64-bit source hash, so a source
+// shared by many programs is only compiled once. Stages compiled for
+// 'shader_create' are deleted with the last program using them, the ones
+// returned here stay until the cache is cleared. Returns a stage with handle
+// 0 if compilation fails.
+extern shader_stage_t shader_stage_compile(shader_stage_type_t type, str_t source);
+// Deletes every cached stage. Linked programs aren't affected.
+extern void shader_stage_cache_clear(void);
+
+typedef struct shader_stage_cache_stats_t shader_stage_cache_stats_t;
+struct shader_stage_cache_stats_t {
+    u32 stage_count;
+    // Compilations served from the cache.
+    u32 hits;
+    u32 misses;
+};
+
+extern shader_stage_cache_stats_t shader_stage_cache_stats(void);
+
+// Linked programs are stored in 'dir', keyed by the hash of both sources and
+// the GL vendor, renderer and version. 'shader_create' loads them from there
+// and falls back to compiling when a binary is missing or rejected by the
+// driver. Stays disabled if the driver has no binary formats, as on WebGL.
+extern void shader_binary_cache_init(const char* dir);
+
+typedef struct shader_binary_cache_stats_t shader_binary_cache_stats_t;
+struct shader_binary_cache_stats_t {
+    b8 enabled;
+    u32 hits;
+    u32 misses;
+    // Binaries found on disk but refused by the driver. Counted as misses.
+    u32 rejected;
+};
+
+extern shader_binary_cache_stats_t shader_binary_cache_stats(void);
+
+// Returns a shader with handle 0 if either stage is invalid or linking fails.
+extern shader_t shader_link(shader_stage_t vertex, shader_stage_t fragment);
+// Loads the program from the binary cache, otherwise compiles both stages
+// through the stage cache and links them. Returns a shader with handle 0 on
+// failure.
 extern shader_t shader_create(str_t vertex_source, str_t fragment_source);
+// Like 'shader_create' but returns without waiting for the driver, so many
+// programs compile in parallel. The status is only queried by 'shader_poll'
+// or once the shader is first used, which waits for it. Failed shaders keep
+// their handle and are never bound.
+extern shader_t shader_create_async(str_t vertex_source, str_t fragment_source);
+// Doesn't block if the driver supports KHR_parallel_shader_compile. Without
+// it a pending shader is waited for.
+extern shader_status_t shader_poll(shader_t shader);
 extern void shader_destroy(shader_t shader);
 extern void shader_use(shader_t shader);
 
+// Returns a uniform with location -1 if the name isn't an active uniform.
+// Setting such a uniform is a no-op.
+extern uniform_t shader_uniform(shader_t shader, const char* name);
+
+// Assigns the uniform block 'name' to a binding point of
+// 'uniform_buffer_bind_range'. 'size' is the size of the C struct mirroring
+// the block and is checked against the block. Does nothing if the shader has
+// no such block.
+extern void shader_uniform_block(shader_t shader, const char* name, u32 binding, u32 size);
+
+// Handle based setters. They act on the currently used shader.
+extern void uniform_set_vec4(uniform_t uniform, Vec4 value);
+extern void uniform_set_mat4(uniform_t uniform, Mat4 value);
+extern void uniform_set_f32(uniform_t uniform, f32 value);
+extern void uniform_set_i32(uniform_t uniform, i32 value);
+
+// Name based setters. Looked up in the reflection table of the shader.
 extern void shader_uniform_vec4(shader_t shader, const char* name, Vec4 value);
 extern void shader_uniform_mat4(shader_t shader, const char* name, Mat4 value);
 extern void shader_uniform_f32(shader_t shader, const char* name, f32 value);
@@ -87,6 +271,8 @@ typedef struct texture_t texture_t;
 struct texture_t {
     u32 handle;
     Ivec2 size;
+    // Incremented every time the storage is reallocated by 'texture_resize'.
+    u32 generation;
 };
 
 typedef enum texture_format_t {
@@ -151,6 +337,9 @@ extern void framebuffer_attach(framebuffer_t fb,
         framebuffer_attachment_t attachment,
         u32 slot,
         texture_t texture);
+// Checks for completeness. This can stall the pipeline so only call it after
+// the attachments have changed.
+extern b8 framebuffer_validate(framebuffer_t fb);
 
 // -- Pipeline -----------------------------------------------------------------
 // Holds all state needed for the GPU to draw. Things like blend state and
@@ -172,6 +361,9 @@ struct vertex_layout_t {
     u32 stride;
     vertex_attribute_t* attribs;
     u32 attrib_count;
+    // 0 advances the attributes every vertex. N advances them once every N
+    // instances.
+    u32 divisor;
 };
 
 typedef enum blend_op_t {
@@ -203,6 +395,10 @@ typedef struct pipeline_desc_t pipeline_desc_t;
 struct pipeline_desc_t {
     vertex_layout_t vertex_layout;
     vertex_buffer_t vertex_buffer;
+    // Optional per instance attributes. Their locations follow the vertex
+    // attributes and the layout should have a non zero divisor.
+    vertex_layout_t instance_layout;
+    vertex_buffer_t instance_buffer;
     blend_state_t blend;
 };
 
@@ -215,6 +411,9 @@ struct pipeline_t {
 extern pipeline_t pipeline_create(pipeline_desc_t desc);
 extern void pipeline_destroy(pipeline_t pipeline);
 extern void pipeline_bind(pipeline_t pipeline);
+// Sources the instance attributes from 'buffer' starting 'offset' bytes in.
+// The attribute array of the instance layout needs to still be alive.
+extern void pipeline_set_instance_buffer(pipeline_t* pipeline, vertex_buffer_t buffer, u32 offset);
 
 // -- Render pass --------------------------------------------------------------
 
@@ -223,9 +422,14 @@ typedef enum load_op_t {
     LOAD_OP_CLEAR,
 } load_op_t;
 
+// Further limited by GL_MAX_DRAW_BUFFERS, at least 4 on GLES 3.
+#define RENDER_PASS_MAX_TARGETS 32
+
 typedef struct render_pass_desc_t render_pass_desc_t;
 struct render_pass_desc_t {
-    texture_t targets[32];
+    // The textures are referenced and need to outlive the pass. They are
+    // re-attached when they get resized.
+    texture_t* targets[RENDER_PASS_MAX_TARGETS];
     u32 target_count;
     load_op_t load_op;
     color_t clear_color;
@@ -235,8 +439,14 @@ typedef struct render_pass_t render_pass_t;
 struct render_pass_t {
     render_pass_desc_t desc;
     framebuffer_t target_fb;
+    // Generation of each target when it was last attached.
+    u32 target_generations[RENDER_PASS_MAX_TARGETS];
+    // False while the framebuffer is incomplete. An invalid pass is checked
+    // again every time it begins.
+    b8 valid;
 };
 
+// Aborts if the pass has more targets than the driver can draw to.
 extern render_pass_t render_pass_create(render_pass_desc_t desc);
 extern void render_pass_destroy(render_pass_t pass);
 
@@ -245,7 +455,67 @@ extern void render_pass_end(render_pass_t* pass);
 #define RENDER_PASS(PASS) \
     for (b8 _i_ = (render_pass_begin(PASS), false); !_i_; _i_ = true, render_pass_end(PASS))
 
+extern void viewport_set(i32 x, i32 y, i32 width, i32 height);
+
 extern void draw(u32 vertex_count, u32 first_vertex);
 extern void draw_indexed(u32 index_count, u32 first_index);
+extern void draw_indexed_instanced(u32 index_count, u32 first_index, u32 instance_count);
+
+// -- GPU timing ---------------------------------------------------------------
+// Scopes are timed on the GPU with timestamp queries. Results are read back a
+// few frames later so reading them never stalls. WebGL 2 needs
+// EXT_disjoint_timer_query_webgl2, and frames during which the GPU reports a
+// disjoint are dropped. Without timer query support every function is a
+// no-op apart from the profiler zones, and no stats are gathered.
+
+// Opens a debug group and starts timing it. Also records a CPU profiler zone.
+extern void gpu_scope_push(const char* name);
+extern void gpu_scope_pop(void);
+#define GPU_SCOPE(NAME) \
+    for (b8 _j_ = (gpu_scope_push(NAME), false); !_j_; _j_ = true, gpu_scope_pop())
+
+typedef struct gpu_timer_stats_t gpu_timer_stats_t;
+struct gpu_timer_stats_t {
+    const char* name;
+    // Rolling window of the last samples, in milliseconds. Scopes with the
+    // same name in one frame are summed into one sample.
+    f32 min_ms;
+    f32 avg_ms;
+    f32 max_ms;
+    u32 sample_count;
+};
+
+extern b8 gpu_timer_available(void);
+// Call at the start and end of every frame.
+extern void gpu_timer_frame_begin(void);
+extern void gpu_timer_frame_end(void);
+extern u32 gpu_timer_scope_count(void);
+extern gpu_timer_stats_t gpu_timer_scope_stats(u32 index);
+// Returns zeroed stats if no scope with the name has been timed.
+extern gpu_timer_stats_t gpu_timer_stats(const char* name);
+// Drops all samples and in flight queries, e.g. after warming up. Call
+// outside of a frame.
+extern void gpu_timer_reset(void);
+
+// -- State cache --------------------------------------------------------------
+// The render API keeps a shadow copy of the GL state it touches and skips any
+// call which wouldn't change it.
+
+typedef struct render_stats_t render_stats_t;
+struct render_stats_t {
+    // State changing GL calls which were issued.
+    u32 state_changes;
+    // Redundant state changing calls which were skipped.
+    u32 state_changes_skipped;
+    u32 draw_calls;
+    // glUniform calls and uniform buffer uploads.
+    u32 uniform_updates;
+};
+
+extern render_stats_t render_stats_get(void);
+extern void render_stats_reset(void);
+// Forget all cached state. Needed if GL state is modified outside of the
+// render API.
+extern void render_state_invalidate(void);
 
 #endif // RENDER_API_H
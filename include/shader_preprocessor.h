@@ -0,0 +1,48 @@
+#ifndef SHADER_PREPROCESSOR_H
+#define SHADER_PREPROCESSOR_H
+
+#include "core.h"
+#include "render_api.h"
+
+// -- Shader preprocessor ------------------------------------------------------
+// Turns a shader source into what's handed to the driver:
+//   - A '#version' line and, for fragment shaders on GLES, a default
+//     precision. Sources don't declare either themselves.
+//   - '#define' lines for the given defines.
+//   - '#include "name"' lines replaced by the file, each file at most once.
+// '#line' directives keep compile errors pointing at the right line. Source
+// string 0 is the main file, includes are numbered in order of appearance.
+
+#define SHADER_MAX_INCLUDES 16
+#define SHADER_MAX_INCLUDE_DEPTH 8
+
+// Returns the contents of an included file, or a string with NULL data if
+// there's no such file.
+typedef str_t (*shader_include_resolver_t)(void* user_ptr, str_t name);
+
+typedef struct shader_define_t shader_define_t;
+struct shader_define_t {
+    const char* name;
+    // NULL defines the name without a value.
+    const char* value;
+};
+
+typedef struct shader_preprocess_desc_t shader_preprocess_desc_t;
+struct shader_preprocess_desc_t {
+    shader_stage_type_t stage;
+    str_t source;
+    // Used in error messages.
+    str_t name;
+
+    const shader_define_t* defines;
+    u32 define_count;
+
+    shader_include_resolver_t resolve_include;
+    void* user_ptr;
+};
+
+// The result is pushed onto 'arena'. Returns a string with NULL data if an
+// include can't be resolved.
+extern str_t shader_preprocess(arena_t* arena, shader_preprocess_desc_t desc);
+
+#endif // SHADER_PREPROCESSOR_H
@@ -1,18 +1,14 @@
-#ifdef __EMSCRIPTEN__
-#include <glad/gles2.h>
-#else
-#include <glad/gl.h>
-#endif
-
+#include "command_buffer.h"
 #include "core.h"
 #include "program.h"
+#include "profiler.h"
 #include "render_api.h"
+#include "shader_preprocessor.h"
 #include <stdio.h>
 
-#ifdef __EMSCRIPTEN__
-#define glPushDebugGroup(...)
-#define glPopDebugGroup(...)
-#endif
+#ifdef SHADER_HOT_RELOAD_ENABLED
+#include <time.h>
+#endif // SHADER_HOT_RELOAD_ENABLED
 
 typedef struct vert_t vert_t;
 struct vert_t {
@@ -20,21 +16,6 @@ struct vert_t {
     Vec2 uv;
 };
 
-typedef struct light_t light_t;
-struct light_t {
-    Vec3 pos;
-    Vec3 size;
-    color_t color;
-    float intensity;
-};
-
-typedef struct obj_t obj_t;
-struct obj_t {
-    Vec3 pos;
-    Vec3 size;
-    color_t color;
-};
-
 static Quad quad_init(void) {
     vert_t verts[] = {
         { vec2(-0.5f, -0.5f), vec2(0.0f, 0.0f) },
@@ -92,13 +73,36 @@ static void draw_quad(Quad quad) {
     draw_indexed(quad.ib.count, 0);
 }
 
-static post_processing_t post_processing_init(arena_t* arena, str_t vert) {
-    str_t color_correction_frag = str_read_file(arena, str_lit("assets/shaders/color_correction.frag.glsl"));
-    str_t bloom_downsample_sample_frag = str_read_file(arena, str_lit("assets/shaders/bloom_downsample.frag.glsl"));
-    str_t bloom_upsample_sample_frag = str_read_file(arena, str_lit("assets/shaders/bloom_upsample.frag.glsl"));
+// Layout of 'instance_t' in the scene batch. Kept at file scope since the
+// batch reads it again whenever a flush moves the instance offset.
+static vertex_attribute_t instance_attribs[] = {
+    [0] = {
+        .type = VERTEX_ATTRIB_TYPE_F32,
+        .count = 3,
+        .offset = offset(instance_t, pos),
+    },
+    [1] = {
+        .type = VERTEX_ATTRIB_TYPE_F32,
+        .count = 3,
+        .offset = offset(instance_t, size),
+    },
+    [2] = {
+        .type = VERTEX_ATTRIB_TYPE_F32,
+        .count = 4,
+        .offset = offset(instance_t, color),
+    },
+    [3] = {
+        .type = VERTEX_ATTRIB_TYPE_F32,
+        .count = 1,
+        .offset = offset(instance_t, intensity),
+    },
+};
 
+static post_processing_t post_processing_init(arena_t* arena) {
     const u32 max_pass_count = 16;
 
+    const char* prev_tag = arena_set_tag(arena, "bloom passes");
+
     texture_t* downsample_textures = arena_push_array(arena, texture_t, max_pass_count);
     texture_t* upsample_textures = arena_push_array(arena, texture_t, max_pass_count);
     render_pass_t* downsample_passes = arena_push_array(arena, render_pass_t, max_pass_count);
@@ -113,40 +117,38 @@ static post_processing_t post_processing_init(arena_t* arena, str_t vert) {
         downsample_textures[i] = texture_create(desc);
         upsample_textures[i] = texture_create(desc);
         downsample_passes[i] = render_pass_create((render_pass_desc_t) {
-                .targets = {downsample_textures[i]},
+                .targets = {&downsample_textures[i]},
                 .target_count = 1,
                 .load_op = LOAD_OP_LOAD,
             });
         upsample_passes[i] = render_pass_create((render_pass_desc_t) {
-                .targets = {upsample_textures[i]},
+                .targets = {&upsample_textures[i]},
                 .target_count = 1,
                 .load_op = LOAD_OP_LOAD,
             });
     }
+    arena_set_tag(arena, prev_tag);
 
     return (post_processing_t) {
         .pass = render_pass_create((render_pass_desc_t) {
                 .target_count = 0,
                 .load_op = LOAD_OP_CLEAR,
             }),
-        .color_correction = {
-            .shader = shader_create(vert, color_correction_frag),
-        },
         .bloom = {
             .downsample_textures = downsample_textures,
             .downsample_passes = downsample_passes,
-            .downsample_shader = shader_create(vert, bloom_downsample_sample_frag),
 
             .upsample_textures = upsample_textures,
             .upsample_passes = upsample_passes,
-            .upsample_shader = shader_create(vert, bloom_upsample_sample_frag),
 
+            .pass_limit = max_pass_count,
             .max_pass_count = max_pass_count,
         },
     };
 }
 
 static void resize_screen_textures(app_t* app) {
+    PROFILE_BEGIN("resize_screen_textures");
     texture_desc_t desc = {
         .data = NULL,
         .width = app->size.x,
@@ -163,7 +165,7 @@ static void resize_screen_textures(app_t* app) {
     // Bloom textures
     Ivec2 size = app->size;
     u32 pass_count = 0;
-    for (u32 i = 0; i < app->pp.bloom.max_pass_count; i++) {
+    for (u32 i = 0; i < app->pp.bloom.pass_limit; i++) {
         texture_desc_t desc = {
             .sampler = TEXTURE_SAMPLER_LINEAR,
             .format = TEXTURE_FORMAT_RGBA_F16,
@@ -180,16 +182,305 @@ static void resize_screen_textures(app_t* app) {
         size = ivec2_divs(size, 2);
     }
     app->pp.bloom.pass_count = pass_count;
+    PROFILE_END();
+}
+
+// -- Shader sources ------------------------------------------------------------
+
+#define SHADER_DIR "shaders/"
+
+static const char* shader_source_names[SHADER_SOURCE_COUNT] = {
+    [SHADER_SOURCE_VERT] = SHADER_DIR "vert.glsl",
+    [SHADER_SOURCE_INSTANCE_VERT] = SHADER_DIR "instance.vert.glsl",
+    [SHADER_SOURCE_OBJ_FRAG] = SHADER_DIR "obj.frag.glsl",
+    [SHADER_SOURCE_LIGHT_FRAG] = SHADER_DIR "light.frag.glsl",
+    [SHADER_SOURCE_SCREEN_FRAG] = SHADER_DIR "screen.frag.glsl",
+    [SHADER_SOURCE_COLOR_CORRECTION_FRAG] = SHADER_DIR "color_correction.frag.glsl",
+    [SHADER_SOURCE_BLOOM_FRAG] = SHADER_DIR "bloom.frag.glsl",
+    [SHADER_SOURCE_SAMPLING] = SHADER_DIR "sampling.glsl",
+    [SHADER_SOURCE_FRAME] = SHADER_DIR "frame.glsl",
+};
+
+// Indexed by the bit of the feature.
+static const char* shader_feature_names[] = {
+    "BLOOM_UPSAMPLE",
+};
+
+// Every program of the app and the variant it uses.
+typedef struct shader_program_t shader_program_t;
+struct shader_program_t {
+    // Of the shader inside 'app_t'.
+    u64 offset;
+    shader_source_t vert;
+    shader_source_t frag;
+    u32 features;
+};
+
+static const shader_program_t shader_programs[] = {
+    { offset(app_t, obj_shader), SHADER_SOURCE_INSTANCE_VERT, SHADER_SOURCE_OBJ_FRAG, 0 },
+    { offset(app_t, light_shader), SHADER_SOURCE_INSTANCE_VERT, SHADER_SOURCE_LIGHT_FRAG, 0 },
+    { offset(app_t, screen_shader), SHADER_SOURCE_VERT, SHADER_SOURCE_SCREEN_FRAG, 0 },
+    { offset(app_t, pp.color_correction.shader), SHADER_SOURCE_VERT, SHADER_SOURCE_COLOR_CORRECTION_FRAG, 0 },
+    { offset(app_t, pp.bloom.downsample_shader), SHADER_SOURCE_VERT, SHADER_SOURCE_BLOOM_FRAG, 0 },
+    { offset(app_t, pp.bloom.upsample_shader), SHADER_SOURCE_VERT, SHADER_SOURCE_BLOOM_FRAG, SHADER_FEATURE_BLOOM_UPSAMPLE },
+};
+
+// Samplers can't live in uniform blocks. Their texture units are set once
+// per program instead of every draw.
+typedef struct shader_sampler_t shader_sampler_t;
+struct shader_sampler_t {
+    const char* name;
+    i32 unit;
+};
+
+static const shader_sampler_t shader_samplers[] = {
+    { "tex", 0 },
+    { "obj", 0 },
+    { "light", 1 },
+    { "src_texture", 0 },
+    { "curr_texture", 1 },
+    { "scene", 0 },
+    { "bloom", 1 },
+};
+
+static shader_t* shader_program_get(app_t* app, const shader_program_t* program) {
+    return (shader_t*) ((u8*) app + program->offset);
+}
+
+// Looks a source up by its name relative to the shader directory. Returns -1
+// if there's no such source.
+static i32 shader_source_find(str_t name) {
+    u32 dir_len = strlen(SHADER_DIR);
+    for (u32 i = 0; i < SHADER_SOURCE_COUNT; i++) {
+        const char* source_name = shader_source_names[i] + dir_len;
+        if (strlen(source_name) == name.len && memcmp(source_name, name.data, name.len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static str_t shader_include_resolve(void* user_ptr, str_t name) {
+    const app_t* app = user_ptr;
+    i32 source = shader_source_find(name);
+    return source != -1 ? app->shader_sources[source] : (str_t) {0};
+}
+
+// -- Shader variants -----------------------------------------------------------
+
+// Returns a shader with handle 0 if preprocessing fails. With 'wait' the
+// shader is compiled synchronously.
+static shader_t shader_variant_compile(app_t* app, shader_source_t vert, shader_source_t frag, u32 features, b8 wait) {
+    arena_temp_t scratch = arena_scratch(NULL, 0);
+    shader_define_t defines[arr_len(shader_feature_names)];
+    u32 define_count = 0;
+    for (u32 i = 0; i < arr_len(shader_feature_names); i++) {
+        if (features & (1u << i)) {
+            defines[define_count++] = (shader_define_t) { .name = shader_feature_names[i] };
+        }
+    }
+
+    shader_stage_type_t stages[] = {SHADER_STAGE_VERTEX, SHADER_STAGE_FRAGMENT};
+    shader_source_t sources[] = {vert, frag};
+    str_t processed[2];
+    for (u32 i = 0; i < 2; i++) {
+        processed[i] = shader_preprocess(scratch.arena, (shader_preprocess_desc_t) {
+                .stage = stages[i],
+                .source = app->shader_sources[sources[i]],
+                .name = str_cstr(shader_source_names[sources[i]]),
+                .defines = defines,
+                .define_count = define_count,
+                .resolve_include = shader_include_resolve,
+                .user_ptr = app,
+            });
+    }
+
+    shader_t shader = {0};
+    if (processed[0].data != NULL && processed[1].data != NULL) {
+        shader = wait ?
+            shader_create(processed[0], processed[1]) :
+            shader_create_async(processed[0], processed[1]);
+    }
+    arena_scratch_release(scratch);
+    return shader;
+}
+
+// Returns the variant, submitting it for compilation on the first request.
+static shader_t shader_variant_get(app_t* app, shader_source_t vert, shader_source_t frag, u32 features) {
+    for (u32 i = 0; i < app->shader_variant_count; i++) {
+        const shader_variant_t* variant = &app->shader_variants[i];
+        if (variant->vert == vert && variant->frag == frag && variant->features == features) {
+            return variant->shader;
+        }
+    }
+
+    if (app->shader_variant_count == APP_MAX_SHADER_VARIANTS) {
+        printf("ERROR: Too many shader variants, at most %u are supported.\n", APP_MAX_SHADER_VARIANTS);
+        return (shader_t) {0};
+    }
+    shader_variant_t* variant = &app->shader_variants[app->shader_variant_count++];
+    *variant = (shader_variant_t) {
+        .vert = vert,
+        .frag = frag,
+        .features = features,
+        .shader = shader_variant_compile(app, vert, frag, features, false),
+    };
+    return variant->shader;
+}
+
+// Points every program at its current variant.
+static void shaders_update(app_t* app) {
+    for (u32 i = 0; i < arr_len(shader_programs); i++) {
+        const shader_program_t* program = &shader_programs[i];
+        *shader_program_get(app, program) = shader_variant_get(app, program->vert, program->frag, program->features);
+    }
+}
+
+// Assigns the uniform block bindings and sampler units of a linked variant.
+// Both are program state, so this is only needed once per link.
+static void shader_variant_bind(shader_t shader) {
+    if (shader_poll(shader) != SHADER_STATUS_READY) {
+        return;
+    }
+    shader_uniform_block(shader, "frame_constants", UNIFORM_BINDING_FRAME, sizeof(frame_constants_t));
+    shader_uniform_block(shader, "draw_constants", UNIFORM_BINDING_DRAW, sizeof(draw_constants_t));
+
+    shader_use(shader);
+    for (u32 i = 0; i < arr_len(shader_samplers); i++) {
+        uniform_set_i32(shader_uniform(shader, shader_samplers[i].name), shader_samplers[i].unit);
+    }
+}
+
+// Submits every program at once so the driver compiles them in parallel.
+static void shaders_create(app_t* app) {
+    PROFILE_BEGIN("shaders_create");
+    shaders_update(app);
+    PROFILE_END();
+}
+
+// Sets 'shaders_ready' once no program is pending anymore.
+static void shaders_poll(app_t* app) {
+    if (app->shader_sources_pending > 0 || app->shader_sources_failed > 0) {
+        return;
+    }
+    for (u32 i = 0; i < app->shader_variant_count; i++) {
+        if (shader_poll(app->shader_variants[i].shader) == SHADER_STATUS_PENDING) {
+            return;
+        }
+    }
+    app->shaders_ready = true;
+    for (u32 i = 0; i < app->shader_variant_count; i++) {
+        shader_variant_bind(app->shader_variants[i].shader);
+    }
+
+    // Diagnostics go to stderr so they don't end up in the results tools
+    // like the bench write to stdout.
+    shader_stage_cache_stats_t stats = shader_stage_cache_stats();
+    fprintf(stderr, "Linked %u shader variants from %u compiled stages, %u stages reused.\n",
+            app->shader_variant_count, stats.misses, stats.hits);
+    shader_binary_cache_stats_t binary_stats = shader_binary_cache_stats();
+    if (binary_stats.enabled) {
+        fprintf(stderr, "Program binary cache: %u hits, %u misses (%u rejected).\n",
+                binary_stats.hits, binary_stats.misses, binary_stats.rejected);
+    }
+}
+
+#ifdef SHADER_HOT_RELOAD_ENABLED
+static f64 reload_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+// Relinks the variants built from a changed source. Includes may be used by
+// any source so they relink every variant. Variants which fail to compile
+// keep running with their previous version.
+static void shaders_reload(app_t* app, arena_t* frame_arena) {
+    file_change_list_t list = file_watcher_poll(app->shader_watcher, frame_arena);
+    for (u32 i = 0; i < list.count; i++) {
+        file_change_t change = list.changes[i];
+        i32 source = shader_source_find(change.name);
+        if (source == -1) {
+            continue;
+        }
+
+        f64 start = reload_now_ms();
+        char path[512];
+        snprintf(path, sizeof(path), ASSET_SOURCE_DIR "/" SHADER_DIR "%.*s", str_arg(change.name));
+        // Edits are rare, old sources are simply left behind on the app arena.
+        const char* prev_tag = arena_set_tag(app->arena, "shader reload");
+        str_t content = str_read_file(app->arena, str_cstr(path));
+        arena_set_tag(app->arena, prev_tag);
+        if (content.data == NULL) {
+            continue;
+        }
+        app->shader_sources[source] = content;
+
+        b8 is_include = true;
+        for (u32 j = 0; j < app->shader_variant_count; j++) {
+            const shader_variant_t* variant = &app->shader_variants[j];
+            if (variant->vert == (shader_source_t) source || variant->frag == (shader_source_t) source) {
+                is_include = false;
+                break;
+            }
+        }
+
+        u32 relinked = 0;
+        u32 failed = 0;
+        for (u32 j = 0; j < app->shader_variant_count; j++) {
+            shader_variant_t* variant = &app->shader_variants[j];
+            if (!is_include && variant->vert != (shader_source_t) source && variant->frag != (shader_source_t) source) {
+                continue;
+            }
+            shader_t shader = shader_variant_compile(app, variant->vert, variant->frag, variant->features, true);
+            if (shader.handle == 0) {
+                failed++;
+                continue;
+            }
+            shader_destroy(variant->shader);
+            variant->shader = shader;
+            shader_variant_bind(shader);
+            relinked++;
+        }
+        shaders_update(app);
+
+        f64 reload_ms = reload_now_ms() - start;
+        printf("Reloaded '%.*s': %u variant(s) relinked, %u kept after errors, in %.2f ms (%.2f ms after the write).\n",
+                str_arg(change.name), relinked, failed, reload_ms, change.age_ms + reload_ms);
+    }
+}
+#endif // SHADER_HOT_RELOAD_ENABLED
+
+// Runs on the render thread from 'asset_loader_poll'.
+static void shader_source_loaded(void* user_ptr, str_t name, str_t content, b8 success) {
+    const shader_source_request_t* request = user_ptr;
+    app_t* app = request->app;
+    if (success) {
+        app->shader_sources[request->source] = content;
+    } else {
+        printf("ERROR: Failed to load shader source '%.*s'.\n", str_arg(name));
+        app->shader_sources_failed++;
+    }
+
+    // Failed loads count as done too, so the app stops waiting for them.
+    app->shader_sources_pending--;
+    if (app->shader_sources_pending == 0) {
+        if (app->shader_sources_failed == 0) {
+            shaders_create(app);
+        } else {
+            printf("ERROR: %u shader source(s) failed to load, no shaders are created.\n", app->shader_sources_failed);
+        }
+    }
 }
 
 app_t* app_init(void) {
-    arena_t* arena = arena_new(1<<20);
+    arena_t* arena = arena_new(64ull << 20);
+    arena_set_tag(arena, "app");
     app_t* app = arena_push_type(arena, app_t);
 
-    str_t vert = str_read_file(arena, str_lit("assets/shaders/vert.glsl"));
-    str_t obj_frag = str_read_file(arena, str_lit("assets/shaders/obj.frag.glsl"));
-    str_t light_frag = str_read_file(arena, str_lit("assets/shaders/light.frag.glsl"));
-    str_t screen_frag = str_read_file(arena, str_lit("assets/shaders/screen.frag.glsl"));
+    // Archived sources point straight into the embedded archive. Loose files
+    // next to the executable are only read for assets missing from it.
+    archive_t assets = archive_open(assets_pak, assets_pak_size);
 
     texture_t white_texture = texture_create((texture_desc_t) {
             .data = (u8[]) {255, 255, 255, 255},
@@ -207,46 +498,28 @@ app_t* app_init(void) {
         .sampler = TEXTURE_SAMPLER_LINEAR,
     };
 
-    texture_t obj_render_target = texture_create(desc);
-    texture_t light_render_target = texture_create(desc);
-    texture_t comp_render_target = texture_create(desc);
-    texture_t bloom_map_render_target = texture_create(desc);
-
     *app = (app_t) {
         .arena = arena,
+        .assets = assets,
 
+        .uniforms = uniform_ring_create(16 << 10),
         .quad = quad_init(),
-        .obj_shader = shader_create(vert, obj_frag),
-        .light_shader = shader_create(vert, light_frag),
-        .screen_shader = shader_create(vert, screen_frag),
-        .white_texture = white_texture,
-
-        .obj_render_target = obj_render_target,
-        .obj_pass = render_pass_create((render_pass_desc_t) {
-                .targets = {obj_render_target},
-                .target_count = 1,
-                .load_op = LOAD_OP_CLEAR,
-                .clear_color = COLOR_TRANSPARENT,
-            }),
-
-        .light_render_target = light_render_target,
-        .light_pass = render_pass_create((render_pass_desc_t) {
-                .targets = {light_render_target},
-                .target_count = 1,
-                .load_op = LOAD_OP_CLEAR,
-                .clear_color = COLOR_TRANSPARENT,
+        .batch = batch_new(arena, (batch_desc_t) {
+                .capacity = 4096,
+                .instance_layout = {
+                    .stride = sizeof(instance_t),
+                    .attribs = instance_attribs,
+                    .attrib_count = arr_len(instance_attribs),
+                },
             }),
+        .white_texture = white_texture,
 
-        .comp_render_target = comp_render_target,
-        .bloom_map_render_target = bloom_map_render_target,
-        .comp_pass = render_pass_create((render_pass_desc_t) {
-                .targets = {comp_render_target, bloom_map_render_target},
-                .target_count = 2,
-                .load_op = LOAD_OP_CLEAR,
-                .clear_color = COLOR_BLACK,
-            }),
+        .obj_render_target = texture_create(desc),
+        .light_render_target = texture_create(desc),
+        .comp_render_target = texture_create(desc),
+        .bloom_map_render_target = texture_create(desc),
 
-        .pp = post_processing_init(arena, vert),
+        .pp = post_processing_init(arena),
 
         .screen_pass = render_pass_create((render_pass_desc_t) {
                 // Target the swapchain
@@ -257,10 +530,73 @@ app_t* app_init(void) {
             }),
     };
 
+    // Passes reference their targets so they're created once the targets
+    // live at their final address.
+    app->obj_pass = render_pass_create((render_pass_desc_t) {
+            .targets = {&app->obj_render_target},
+            .target_count = 1,
+            .load_op = LOAD_OP_CLEAR,
+            .clear_color = COLOR_TRANSPARENT,
+        });
+    app->light_pass = render_pass_create((render_pass_desc_t) {
+            .targets = {&app->light_render_target},
+            .target_count = 1,
+            .load_op = LOAD_OP_CLEAR,
+            .clear_color = COLOR_TRANSPARENT,
+        });
+    app->comp_pass = render_pass_create((render_pass_desc_t) {
+            .targets = {&app->comp_render_target, &app->bloom_map_render_target},
+            .target_count = 2,
+            .load_op = LOAD_OP_CLEAR,
+            .clear_color = COLOR_BLACK,
+        });
+
+#ifdef SHADER_CACHE_DIR
+    shader_binary_cache_init(SHADER_CACHE_DIR);
+#endif // SHADER_CACHE_DIR
+
+    // The thread recording the frame takes part in every run, so one core is
+    // left to it.
+    app->jobs = job_system_new(cpu_count() - 1);
+    for (u32 i = 0; i < job_system_thread_count(app->jobs); i++) {
+        app->record_arenas[i] = arena_new(256ull << 20);
+        arena_set_tag(app->record_arenas[i], "scene record");
+    }
+
+    // The loader points at the archive inside the app so it's started last.
+    app->loader = asset_loader_new(&app->assets, "assets");
+    app->shader_sources_pending = SHADER_SOURCE_COUNT;
+    for (u32 i = 0; i < SHADER_SOURCE_COUNT; i++) {
+        shader_source_request_t* request = &app->shader_source_requests[i];
+        *request = (shader_source_request_t) {
+            .app = app,
+            .source = i,
+        };
+        asset_loader_request(app->loader, str_cstr(shader_source_names[i]), shader_source_loaded, request);
+    }
+
+#ifdef SHADER_HOT_RELOAD_ENABLED
+    app->shader_watcher = file_watcher_new(ASSET_SOURCE_DIR "/shaders");
+#endif // SHADER_HOT_RELOAD_ENABLED
+
     return app;
 }
 
 void app_shutdown(app_t* app) {
+    asset_loader_free(app->loader);
+    if (app->shader_watcher != NULL) {
+        file_watcher_free(app->shader_watcher);
+    }
+    shader_stage_cache_clear();
+    uniform_ring_destroy(&app->uniforms);
+    batch_free(app->batch);
+    for (u32 i = 0; i < job_system_thread_count(app->jobs); i++) {
+        arena_free(app->record_arenas[i]);
+    }
+    job_system_free(app->jobs);
+#ifdef ARENA_STATS_ENABLED
+    arena_report(app->arena, "app");
+#endif // ARENA_STATS_ENABLED
     arena_free(app->arena);
 }
 
@@ -269,111 +605,310 @@ void app_resize(app_t* app, Ivec2 size) {
     resize_screen_textures(app);
 }
 
-void app_update(app_t* app) {
-    const f32 aspect = (f32) app->size.x / (f32) app->size.y;
-    const f32 zoom = 5.0f;
-    Mat4 proj = mat4_ortho_projection(-aspect*zoom, aspect*zoom, zoom, -zoom, 1.0f, -1.0f);
+void app_set_scene(app_t* app, const scene_t* scene) {
+    app->scene = scene;
+}
 
-    // Object pass
-    glViewport(0, 0, app->size.x, app->size.y);
-    obj_t objs[] = {
-        [0] = { .pos = vec3(1.0f, 1.0f, 0.0f), .size = vec3s(1.0f), .color = color_rgb_hex(0xff00ff) },
-        [1] = { .pos = vec3(-1.0f, -1.0f, 0.0f), .size = vec3s(1.0f), .color = color_rgb_hex(0xff0000) },
-        [2] = { .pos = vec3s(0.0f), .size = vec3s(0.1f), .color = COLOR_WHITE },
+void app_set_bloom_pass_limit(app_t* app, u32 limit) {
+    app->pp.bloom.pass_limit = clamp(limit, 1, app->pp.bloom.max_pass_count);
+    if (app->size.x != 0 && app->size.y != 0) {
+        resize_screen_textures(app);
+    }
+}
+
+b8 app_loading(const app_t* app) {
+    return !app->shaders_ready && !app_failed(app);
+}
+
+b8 app_failed(const app_t* app) {
+    return app->shader_sources_failed > 0;
+}
+
+// Animated scene shown when the app has no scene set.
+static scene_t demo_scene(arena_t* arena) {
+    obj_t* objs = arena_push_array(arena, obj_t, 3);
+    light_t* lights = arena_push_array(arena, light_t, 3);
+
+    objs[0] = (obj_t) { .pos = vec3(1.0f, 1.0f, 0.0f), .size = vec3s(1.0f), .color = color_rgb_hex(0xff00ff) };
+    objs[1] = (obj_t) { .pos = vec3(-1.0f, -1.0f, 0.0f), .size = vec3s(1.0f), .color = color_rgb_hex(0xff0000) };
+    objs[2] = (obj_t) { .pos = vec3s(0.0f), .size = vec3s(0.1f), .color = COLOR_WHITE };
+
+    f32 circle_radius = 4.0f;
+    lights[0] = (light_t) {
+        .pos = vec3(
+                cosf(get_time() * 2.0f + PI) * circle_radius,
+                sinf(get_time() * 2.0f + PI) * circle_radius,
+                0.0f
+            ),
+        .size = vec3(circle_radius * 2.0f, circle_radius * 2.0f, 1.0f),
+        .color = color_rgb_hex(0x80ff33),
+        .intensity = 2.0f,
+    };
+    lights[1] = (light_t) {
+        .pos = vec3(
+                cosf(get_time() * 2.0f) * circle_radius,
+                sinf(get_time() * 2.0f) * circle_radius,
+                0.0f
+            ),
+        .size = vec3(circle_radius * 2.0f, circle_radius * 2.0f, 1.0f),
+        .color = color_rgb_hex(0xff8033),
+        .intensity = 1.0f,
+    };
+    lights[2] = (light_t) {
+        .pos = vec3s(0.0f),
+        .size = vec3(1.0f, 1.0f, 1.0f),
+        .color = color_hsv(get_time()*90.0f, 1.0f, 1.0f),
+        .intensity = 1.0f,
     };
-    RENDER_PASS(&app->obj_pass) {
-        for (u32 i = 0; i < arr_len(objs); i++) {
-            obj_t obj = objs[i];
-
-            Mat4 transform = MAT4_IDENTITY;
-            transform = mat4_translate(transform, obj.pos);
-            transform = mat4_scale(transform, obj.size);
-
-            texture_bind(app->white_texture, 0);
-            shader_use(app->obj_shader);
-            // Vert
-            shader_uniform_mat4(app->obj_shader, "proj", proj);
-            shader_uniform_mat4(app->obj_shader, "transform", transform);
-            // Frag
-            Vec4 v4_color = *(Vec4 *) &obj.color;
-            shader_uniform_vec4(app->obj_shader, "color", v4_color);
-            shader_uniform_i32(app->obj_shader, "tex", 0);
 
-            draw_quad(app->quad);
+    return (scene_t) {
+        .objs = objs,
+        .obj_count = 3,
+        .lights = lights,
+        .light_count = 3,
+    };
+}
+
+// -- Scene commands -----------------------------------------------------------
+// The scene is recorded into a command buffer, one command per object and
+// light with its instance data as payload, and replayed in key order.
+
+// Ids packed into the sort keys.
+typedef enum scene_pass_t {
+    SCENE_PASS_OBJECTS,
+    SCENE_PASS_LIGHTS,
+} scene_pass_t;
+
+typedef enum scene_pipeline_t {
+    SCENE_PIPELINE_INSTANCED,
+} scene_pipeline_t;
+
+typedef enum scene_shader_t {
+    SCENE_SHADER_OBJ,
+    SCENE_SHADER_LIGHT,
+} scene_shader_t;
+
+typedef enum scene_texture_t {
+    SCENE_TEXTURE_WHITE,
+} scene_texture_t;
+
+// Objects or lights recorded by one job. Chunks are a fixed size so the
+// merged buffer is the same whatever the number of threads.
+#define SCENE_RECORD_CHUNK 1024
+
+typedef struct scene_record_t scene_record_t;
+struct scene_record_t {
+    const scene_t* scene;
+    arena_t* const* arenas;
+    // Visible part of the world.
+    Vec2 view_min;
+    Vec2 view_max;
+    u32 obj_chunk_count;
+    // One buffer per chunk, objects first.
+    command_buffer_t** chunks;
+};
+
+static b8 scene_quad_visible(const scene_record_t* record, Vec3 pos, Vec3 size) {
+    f32 half_x = fabsf(size.x) * 0.5f;
+    f32 half_y = fabsf(size.y) * 0.5f;
+    return pos.x + half_x >= record->view_min.x && pos.x - half_x <= record->view_max.x &&
+        pos.y + half_y >= record->view_min.y && pos.y - half_y <= record->view_max.y;
+}
+
+// Culls the chunk against the view and records what's left. The z coordinate
+// is the depth, so higher objects are drawn on top.
+static void scene_record_chunk(scene_record_t* record, u32 index, u32 thread) {
+    const scene_t* scene = record->scene;
+
+    b8 lights = index >= record->obj_chunk_count;
+    u32 first = (lights ? index - record->obj_chunk_count : index) * SCENE_RECORD_CHUNK;
+    u32 total = lights ? scene->light_count : scene->obj_count;
+    u32 count = min(total - first, SCENE_RECORD_CHUNK);
+    command_buffer_t* cb = command_buffer_new(record->arenas[thread], count, count * sizeof(instance_t));
+
+    if (!lights) {
+        for (u32 i = first; i < first + count; i++) {
+            const obj_t* obj = &scene->objs[i];
+            if (!scene_quad_visible(record, obj->pos, obj->size)) {
+                continue;
+            }
+            u64 key = draw_key(SCENE_PASS_OBJECTS, SCENE_PIPELINE_INSTANCED, SCENE_SHADER_OBJ, SCENE_TEXTURE_WHITE, obj->pos.z);
+            instance_t* instance = command_buffer_push(cb, key, sizeof(instance_t));
+            *instance = (instance_t) {
+                .pos = obj->pos,
+                .size = obj->size,
+                .color = obj->color,
+                .intensity = 1.0f,
+            };
+        }
+    } else {
+        for (u32 i = first; i < first + count; i++) {
+            const light_t* light = &scene->lights[i];
+            if (!scene_quad_visible(record, light->pos, light->size)) {
+                continue;
+            }
+            u64 key = draw_key(SCENE_PASS_LIGHTS, SCENE_PIPELINE_INSTANCED, SCENE_SHADER_LIGHT, SCENE_TEXTURE_WHITE, light->pos.z);
+            instance_t* instance = command_buffer_push(cb, key, sizeof(instance_t));
+            *instance = (instance_t) {
+                .pos = light->pos,
+                .size = light->size,
+                .color = light->color,
+                .intensity = light->intensity,
+            };
         }
     }
 
-    // Light pass
-    f32 circle_radius = 4.0f;
-    light_t lights[] = {
-        [0] = {
-            .pos = vec3(
-                    cosf(get_time() * 2.0f + PI) * circle_radius,
-                    sinf(get_time() * 2.0f + PI) * circle_radius,
-                    0.0f
-                ),
-            .size = vec3(circle_radius * 2.0f, circle_radius * 2.0f, 1.0f),
-            .color = color_rgb_hex(0x80ff33),
-            .intensity = 2.0f,
-        },
-        [1] = {
-            .pos = vec3(
-                    cosf(get_time() * 2.0f) * circle_radius,
-                    sinf(get_time() * 2.0f) * circle_radius,
-                    0.0f
-                ),
-            .size = vec3(circle_radius * 2.0f, circle_radius * 2.0f, 1.0f),
-            .color = color_rgb_hex(0xff8033),
-            .intensity = 1.0f,
-        },
-        [2] = {
-            .pos = vec3s(0.0f),
-            .size = vec3(1.0f, 1.0f, 1.0f),
-            .color = color_hsv(get_time()*90.0f, 1.0f, 1.0f),
-            .intensity = 1.0f,
-        },
+    record->chunks[index] = cb;
+}
+
+static void scene_record_chunks(void* user_ptr, u32 begin, u32 end, u32 thread) {
+    for (u32 i = begin; i < end; i++) {
+        scene_record_chunk(user_ptr, i, thread);
+    }
+}
+
+// Records the visible part of the scene in chunks spread over the job
+// system, each into a buffer on the arena of the thread recording it. The
+// chunks are merged in order into one buffer on the frame arena.
+static command_buffer_t* scene_record(app_t* app, const scene_t* scene, Vec2 view_min, Vec2 view_max, arena_t* frame_arena) {
+    PROFILE_BEGIN("scene_record");
+    u32 thread_count = job_system_thread_count(app->jobs);
+    // Popped rather than cleared, like the frame arenas, so a large scene
+    // doesn't give its recording memory back to the OS every frame.
+    for (u32 i = 0; i < thread_count; i++) {
+        arena_pop_to(app->record_arenas[i], 0);
+    }
+
+    u32 obj_chunk_count = (scene->obj_count + SCENE_RECORD_CHUNK - 1) / SCENE_RECORD_CHUNK;
+    u32 light_chunk_count = (scene->light_count + SCENE_RECORD_CHUNK - 1) / SCENE_RECORD_CHUNK;
+    u32 chunk_count = obj_chunk_count + light_chunk_count;
+    scene_record_t record = {
+        .scene = scene,
+        .arenas = app->record_arenas,
+        .view_min = view_min,
+        .view_max = view_max,
+        .obj_chunk_count = obj_chunk_count,
+        .chunks = arena_push_array(frame_arena, command_buffer_t*, chunk_count),
     };
+    parallel_for(app->jobs, chunk_count, 1, scene_record_chunks, &record);
 
-    glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0, -1, "Lights");
-    RENDER_PASS(&app->light_pass) {
-        for (u32 i = 0; i < arr_len(lights); i++) {
-            light_t light = lights[i];
+    u32 count = 0;
+    for (u32 i = 0; i < chunk_count; i++) {
+        count += record.chunks[i]->count;
+    }
+    command_buffer_t* cb = command_buffer_new(frame_arena, count, count * sizeof(instance_t));
+    for (u32 i = 0; i < chunk_count; i++) {
+        command_buffer_append(cb, record.chunks[i]);
+    }
+    PROFILE_END();
+    return cb;
+}
 
-            Mat4 transform = MAT4_IDENTITY;
-            transform = mat4_translate(transform, light.pos);
-            transform = mat4_scale(transform, light.size);
+static shader_t scene_shader(const app_t* app, scene_shader_t id) {
+    switch (id) {
+        case SCENE_SHADER_OBJ:
+            return app->obj_shader;
+        case SCENE_SHADER_LIGHT:
+            return app->light_shader;
+    }
+    return (shader_t) {0};
+}
 
-            texture_bind(app->white_texture, 0);
-            shader_use(app->light_shader);
-            // Vert
-            shader_uniform_mat4(app->light_shader, "proj", proj);
-            shader_uniform_mat4(app->light_shader, "transform", transform);
-            // Frag
-            Vec4 v4_color = *(Vec4 *) &light.color;
-            shader_uniform_vec4(app->light_shader, "color", v4_color);
+static texture_t scene_texture(const app_t* app, scene_texture_t id) {
+    switch (id) {
+        case SCENE_TEXTURE_WHITE:
+            return app->white_texture;
+    }
+    return (texture_t) {0};
+}
 
-            shader_uniform_f32(app->light_shader, "intensity", light.intensity);
+// Replays the commands of one pass of a sorted buffer through the batch.
+// Each run of commands with the same state becomes one instanced draw.
+static void scene_submit(app_t* app, const command_buffer_t* cb, scene_pass_t pass) {
+    u32 first;
+    u32 count = command_buffer_pass(cb, pass, &first);
+    u32 end = first + count;
+    for (u32 i = first; i < end;) {
+        u64 key = cb->commands[i].key;
+        u32 run_end = i + 1;
+        while (run_end < end && draw_key_state(cb->commands[run_end].key) == draw_key_state(key)) {
+            run_end++;
+        }
 
-            draw_quad(app->quad);
+        // The batch is the only pipeline so far. It flushes the previous
+        // run when the state changes.
+        batch_set_texture(app->batch, scene_texture(app, draw_key_texture(key)));
+        batch_set_shader(app->batch, scene_shader(app, draw_key_shader(key)));
+        for (; i < run_end; i++) {
+            batch_quad(app->batch, command_payload(cb, &cb->commands[i]));
         }
     }
-    glPopDebugGroup();
+    batch_flush(app->batch);
+}
 
-    // Composition pass
-    RENDER_PASS(&app->comp_pass) {
-        Mat4 transform = MAT4_IDENTITY;
-        transform = mat4_scale(transform, vec3(2.0f, 2.0f, 1.0f));
+void app_update(app_t* app, arena_t* frame_arena) {
+    asset_loader_poll(app->loader);
+    if (!app->shaders_ready) {
+        shaders_poll(app);
+    }
+    if (!app->shaders_ready) {
+        // Placeholder frame, presented right away while the shaders stream in
+        // and compile.
+        viewport_set(0, 0, app->size.x, app->size.y);
+        RENDER_PASS(&app->screen_pass) {}
+        return;
+    }
+#ifdef SHADER_HOT_RELOAD_ENABLED
+    if (app->shader_watcher != NULL) {
+        shaders_reload(app, frame_arena);
+    }
+#endif // SHADER_HOT_RELOAD_ENABLED
+
+    const f32 aspect = (f32) app->size.x / (f32) app->size.y;
+    const f32 zoom = 5.0f;
+    Mat4 proj = mat4_ortho_projection(-aspect*zoom, aspect*zoom, zoom, -zoom, 1.0f, -1.0f);
+
+    gpu_timer_frame_begin();
+
+    // Every pass reads the frame constants and the full screen passes share
+    // one transform, so both are bound for the whole frame.
+    uniform_ring_frame_begin(&app->uniforms);
+    batch_frame_begin(app->batch);
+    frame_constants_t frame_constants = {
+        .proj = proj,
+        .ambient_color = vec4s(1.0f),
+        .time = get_time(),
+    };
+    draw_constants_t screen_constants = {
+        .transform = mat4_scale(MAT4_IDENTITY, vec3(2.0f, 2.0f, 1.0f)),
+    };
+    uniform_range_t frame_range = uniform_ring_push(&app->uniforms, &frame_constants, sizeof(frame_constants));
+    uniform_range_t screen_range = uniform_ring_push(&app->uniforms, &screen_constants, sizeof(screen_constants));
+    uniform_ring_bind(&app->uniforms, frame_range, UNIFORM_BINDING_FRAME);
+    uniform_ring_bind(&app->uniforms, screen_range, UNIFORM_BINDING_DRAW);
+
+    scene_t scene = app->scene != NULL ? *app->scene : demo_scene(frame_arena);
+
+    Vec2 view_extent = vec2(aspect*zoom, zoom);
+    command_buffer_t* commands = scene_record(app, &scene, vec2_muls(view_extent, -1.0f), view_extent, frame_arena);
+    command_buffer_sort(commands, app->jobs);
 
+    // Object pass
+    viewport_set(0, 0, app->size.x, app->size.y);
+    GPU_SCOPE("Objects") RENDER_PASS(&app->obj_pass) {
+        scene_submit(app, commands, SCENE_PASS_OBJECTS);
+    }
+
+    // Light pass
+    GPU_SCOPE("Lights") RENDER_PASS(&app->light_pass) {
+        scene_submit(app, commands, SCENE_PASS_LIGHTS);
+    }
+
+    // Composition pass
+    GPU_SCOPE("Composition") RENDER_PASS(&app->comp_pass) {
         texture_bind(app->obj_render_target, 0);
         texture_bind(app->light_render_target, 1);
         shader_use(app->screen_shader);
-        // Vert
-        shader_uniform_mat4(app->screen_shader, "proj", MAT4_IDENTITY);
-        shader_uniform_mat4(app->screen_shader, "transform", transform);
-        // Frag
-        shader_uniform_i32(app->screen_shader, "obj", 0);
-        shader_uniform_i32(app->screen_shader, "light", 1);
-        shader_uniform_vec4(app->screen_shader, "ambient_color", vec4s(1.0f));
 
         draw_quad(app->quad);
     }
@@ -384,73 +919,49 @@ void app_update(app_t* app) {
 
     // Bloom
     // https://catlikecoding.com/unity/tutorials/advanced-rendering/bloom/
-    glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0, -1, "Bloom");
+    gpu_scope_push("Bloom");
     // Downsample
-    glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0, -1, "Downsample");
+    gpu_scope_push("Downsample");
     post_processing_t pp = app->pp;
     texture_t src_texture = app->bloom_map_render_target;
     for (u32 i = 0; i < pp.bloom.pass_count; i++) {
-        glViewport(0, 0, vec2_arg(pp.bloom.downsample_textures[i].size));
+        viewport_set(0, 0, vec2_arg(pp.bloom.downsample_textures[i].size));
         RENDER_PASS(&pp.bloom.downsample_passes[i]) {
-            Mat4 transform = MAT4_IDENTITY;
-            transform = mat4_scale(transform, vec3(2.0f, 2.0f, 1.0f));
-
             texture_bind(src_texture, 0);
             shader_use(pp.bloom.downsample_shader);
-            // Vert
-            shader_uniform_mat4(pp.bloom.downsample_shader, "proj", MAT4_IDENTITY);
-            shader_uniform_mat4(pp.bloom.downsample_shader, "transform", transform);
-            // Frag
-            shader_uniform_i32(pp.bloom.downsample_shader, "src_texture", 0);
 
             draw_quad(app->quad);
             src_texture = pp.bloom.downsample_textures[i];
         }
     }
-    glPopDebugGroup();
+    gpu_scope_pop();
 
     // Upsample
-    glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0, -1, "Upsample");
+    gpu_scope_push("Upsample");
     src_texture = pp.bloom.downsample_textures[pp.bloom.pass_count - 1];
     for (i32 i = pp.bloom.pass_count - 2; i >= 0; i--) {
         texture_t curr_texture = pp.bloom.downsample_textures[i];
-        glViewport(0, 0, vec2_arg(curr_texture.size));
+        viewport_set(0, 0, vec2_arg(curr_texture.size));
         RENDER_PASS(&pp.bloom.upsample_passes[i]) {
-            Mat4 transform = MAT4_IDENTITY;
-            transform = mat4_scale(transform, vec3(2.0f, 2.0f, 1.0f));
-
             texture_bind(src_texture, 0);
             texture_bind(curr_texture, 1);
             shader_use(pp.bloom.upsample_shader);
-            // Vert
-            shader_uniform_mat4(pp.bloom.upsample_shader, "proj", MAT4_IDENTITY);
-            shader_uniform_mat4(pp.bloom.upsample_shader, "transform", transform);
-            // Frag
-            shader_uniform_i32(pp.bloom.upsample_shader, "src_texture", 0);
-            shader_uniform_i32(pp.bloom.upsample_shader, "curr_texture", 1);
 
             draw_quad(app->quad);
             src_texture = pp.bloom.upsample_textures[i + 1];
         }
     }
-    glPopDebugGroup();
-    glPopDebugGroup();
+    gpu_scope_pop();
+    gpu_scope_pop();
 
     // Color correction pass
-    RENDER_PASS(&pp.pass) {
-        Mat4 transform = MAT4_IDENTITY;
-        transform = mat4_scale(transform, vec3(2.0f, 2.0f, 1.0f));
-
+    GPU_SCOPE("Color correction") RENDER_PASS(&pp.pass) {
         texture_bind(app->comp_render_target, 0);
         texture_bind(pp.bloom.upsample_textures[0], 1);
         shader_use(pp.color_correction.shader);
-        // Vert
-        shader_uniform_mat4(pp.color_correction.shader, "proj", MAT4_IDENTITY);
-        shader_uniform_mat4(pp.color_correction.shader, "transform", transform);
-        // Frag
-        shader_uniform_i32(pp.color_correction.shader, "scene", 0);
-        shader_uniform_i32(pp.color_correction.shader, "bloom", 1);
 
         draw_quad(app->quad);
     }
+
+    gpu_timer_frame_end();
 }
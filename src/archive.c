@@ -0,0 +1,87 @@
+#include "archive.h"
+#include "core.h"
+
+#include <stdio.h>
+
+#define ARCHIVE_HEADER_SIZE 16
+
+typedef struct archive_entry_t archive_entry_t;
+struct archive_entry_t {
+    u32 name_hash;
+    u32 name_offset;
+    u32 data_offset;
+    u32 data_size;
+};
+
+// Archives can come from anywhere so fields are read through memcpy instead
+// of relying on alignment. Assumes a little endian host, like every target we
+// build for.
+static u32 read_u32(const u8* data) {
+    u32 value;
+    memcpy(&value, data, sizeof(u32));
+    return value;
+}
+
+static archive_entry_t entry_read(const archive_t* archive, u32 slot) {
+    const u8* data = archive->data + ARCHIVE_HEADER_SIZE + slot * sizeof(archive_entry_t);
+    return (archive_entry_t) {
+        .name_hash = read_u32(data),
+        .name_offset = read_u32(data + 4),
+        .data_offset = read_u32(data + 8),
+        .data_size = read_u32(data + 12),
+    };
+}
+
+archive_t archive_open(const u8* data, u64 size) {
+    if (size < ARCHIVE_HEADER_SIZE || read_u32(data) != ARCHIVE_MAGIC) {
+        printf("ERROR: Not an archive.\n");
+        return (archive_t) {0};
+    }
+
+    archive_t archive = {
+        .data = data,
+        .size = size,
+        .entry_count = read_u32(data + 4),
+        .table_capacity = read_u32(data + 8),
+        .valid = true,
+    };
+    u32 cap = archive.table_capacity;
+    if (cap == 0 || (cap & (cap - 1)) != 0 ||
+            ARCHIVE_HEADER_SIZE + (u64) cap * sizeof(archive_entry_t) > size) {
+        printf("ERROR: Archive has a corrupt index.\n");
+        return (archive_t) {0};
+    }
+
+    return archive;
+}
+
+str_t archive_find(const archive_t* archive, str_t name) {
+    if (!archive->valid) {
+        return (str_t) {0};
+    }
+
+    u32 hash = str_hash(name);
+    u32 mask = archive->table_capacity - 1;
+    for (u32 i = 0; i < archive->table_capacity; i++) {
+        archive_entry_t entry = entry_read(archive, (hash + i) & mask);
+        if (entry.data_offset == 0) {
+            break;
+        }
+        if (entry.name_hash != hash) {
+            continue;
+        }
+
+        // Names are NUL terminated so a longer name never matches a prefix.
+        if ((u64) entry.name_offset + name.len >= archive->size ||
+                (u64) entry.data_offset + entry.data_size > archive->size) {
+            printf("ERROR: Archive entry '%.*s' is out of bounds.\n", str_arg(name));
+            return (str_t) {0};
+        }
+        const u8* entry_name = archive->data + entry.name_offset;
+        if (memcmp(entry_name, name.data, name.len) == 0 && entry_name[name.len] == 0) {
+            return str(archive->data + entry.data_offset, entry.data_size);
+        }
+    }
+
+    return (str_t) {0};
+}
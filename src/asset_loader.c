@@ -0,0 +1,173 @@
+#include "asset_loader.h"
+#include "core.h"
+#include "profiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Power of two. Bounds the number of loads in flight.
+#define ASSET_QUEUE_SIZE 256
+#define CACHE_LINE 64
+
+typedef struct asset_load_t asset_load_t;
+struct asset_load_t {
+    str_t name;
+    asset_loaded_callback_t callback;
+    void* user_ptr;
+
+    str_t content;
+    b8 success;
+};
+
+// Single producer, single consumer ring. Both indices only ever grow and
+// wrap around naturally.
+typedef struct asset_queue_t asset_queue_t;
+struct asset_queue_t {
+    asset_load_t items[ASSET_QUEUE_SIZE];
+    // Written by the consumer.
+    __attribute__((aligned(CACHE_LINE))) u32 head;
+    // Written by the producer.
+    __attribute__((aligned(CACHE_LINE))) u32 tail;
+};
+
+static b8 queue_push(asset_queue_t* queue, asset_load_t item) {
+    u32 tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    u32 head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    if (tail - head == ASSET_QUEUE_SIZE) {
+        return false;
+    }
+    queue->items[tail & (ASSET_QUEUE_SIZE - 1)] = item;
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static b8 queue_pop(asset_queue_t* queue, asset_load_t* item) {
+    u32 head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    u32 tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+        return false;
+    }
+    *item = queue->items[head & (ASSET_QUEUE_SIZE - 1)];
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+struct asset_loader_t {
+    const archive_t* archive;
+    const char* root;
+
+    asset_queue_t requests;
+    asset_queue_t completions;
+    // Requests pushed minus completions popped. Only touched by the owner.
+    u32 in_flight;
+
+    thread_t* worker;
+    // Posted once per request and once on shutdown.
+    semaphore_t* work;
+    b8 quit;
+
+    // Contents read from disk, kept until the loader is freed. Each thread
+    // has its own. Only reserved address space until something is read.
+    arena_t* worker_arena;
+    arena_t* owner_arena;
+};
+
+static void asset_load(const asset_loader_t* loader, arena_t* arena, asset_load_t* load) {
+    PROFILE_BEGIN("asset_load");
+    if (loader->archive != NULL) {
+        str_t content = archive_find(loader->archive, load->name);
+        if (content.data != NULL) {
+            load->content = content;
+            load->success = true;
+            PROFILE_END();
+            return;
+        }
+    }
+
+    arena_temp_t scratch = arena_scratch(&arena, 1);
+    u32 path_len = strlen(loader->root) + 1 + load->name.len;
+    char* path = arena_push(scratch.arena, path_len + 1);
+    snprintf(path, path_len + 1, "%s/%.*s", loader->root, str_arg(load->name));
+
+    load->content = str_read_file(arena, str((const u8*) path, path_len));
+    load->success = load->content.data != NULL;
+
+    arena_scratch_release(scratch);
+    PROFILE_END();
+}
+
+static void asset_worker(void* arg) {
+    asset_loader_t* loader = arg;
+    while (true) {
+        semaphore_wait(loader->work);
+        if (__atomic_load_n(&loader->quit, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+
+        asset_load_t load;
+        if (!queue_pop(&loader->requests, &load)) {
+            continue;
+        }
+        asset_load(loader, loader->worker_arena, &load);
+        // Never full since the owner bounds the loads in flight.
+        queue_push(&loader->completions, load);
+    }
+}
+
+asset_loader_t* asset_loader_new(const archive_t* archive, const char* root) {
+    asset_loader_t* loader = malloc(sizeof(asset_loader_t));
+    *loader = (asset_loader_t) {
+        .archive = archive,
+        .root = root,
+        .work = semaphore_new(0),
+        .worker_arena = arena_new(256ull << 20),
+        .owner_arena = arena_new(256ull << 20),
+    };
+    // The web build isn't linked with pthreads.
+#ifndef __EMSCRIPTEN__
+    loader->worker = thread_create(asset_worker, loader);
+    if (loader->worker == NULL) {
+        printf("ERROR: Failed to start the asset loader thread, loading synchronously.\n");
+    }
+#endif // __EMSCRIPTEN__
+    return loader;
+}
+
+void asset_loader_free(asset_loader_t* loader) {
+    if (loader->worker != NULL) {
+        __atomic_store_n(&loader->quit, true, __ATOMIC_RELEASE);
+        semaphore_post(loader->work);
+        thread_join(loader->worker);
+    }
+    semaphore_free(loader->work);
+    arena_free(loader->worker_arena);
+    arena_free(loader->owner_arena);
+    free(loader);
+}
+
+void asset_loader_request(asset_loader_t* loader, str_t name, asset_loaded_callback_t callback, void* user_ptr) {
+    asset_load_t load = {
+        .name = name,
+        .callback = callback,
+        .user_ptr = user_ptr,
+    };
+
+    if (loader->worker != NULL && loader->in_flight < ASSET_QUEUE_SIZE) {
+        queue_push(&loader->requests, load);
+        loader->in_flight++;
+        semaphore_post(loader->work);
+        return;
+    }
+
+    asset_load(loader, loader->owner_arena, &load);
+    load.callback(load.user_ptr, load.name, load.content, load.success);
+}
+
+u32 asset_loader_poll(asset_loader_t* loader) {
+    asset_load_t load;
+    while (queue_pop(&loader->completions, &load)) {
+        loader->in_flight--;
+        load.callback(load.user_ptr, load.name, load.content, load.success);
+    }
+    return loader->in_flight;
+}
@@ -0,0 +1,178 @@
+#include "batch.h"
+#include "core.h"
+#include "render_api.h"
+
+typedef struct batch_vert_t batch_vert_t;
+struct batch_vert_t {
+    Vec2 pos;
+    Vec2 uv;
+};
+
+struct batch_t {
+    vertex_buffer_t quad_vb;
+    index_buffer_t quad_ib;
+    pipeline_t pipe;
+
+    // Instance data is appended until the buffer is full, then the buffer is
+    // orphaned. Draws still reading the old storage keep it alive, so the
+    // driver never waits for the GPU.
+    vertex_buffer_t stream;
+    // Write position in bytes within the stream buffer.
+    u32 stream_offset;
+    u32 stream_size;
+
+    u8* staging;
+    u32 staging_count;
+    u32 capacity;
+    u32 stride;
+
+    shader_t shader;
+    texture_t texture;
+
+    batch_stats_t stats;
+};
+
+batch_t* batch_new(arena_t* arena, batch_desc_t desc) {
+    batch_t* batch = arena_push_type(arena, batch_t);
+    vertex_layout_t instance_layout = desc.instance_layout;
+    instance_layout.divisor = 1;
+    u32 stride = instance_layout.stride;
+    u8* staging = arena_push(arena, desc.capacity * stride);
+
+    batch_vert_t verts[] = {
+        { vec2(-0.5f, -0.5f), vec2(0.0f, 0.0f) },
+        { vec2( 0.5f, -0.5f), vec2(1.0f, 0.0f) },
+        { vec2(-0.5f,  0.5f), vec2(0.0f, 1.0f) },
+        { vec2( 0.5f,  0.5f), vec2(1.0f, 1.0f) },
+    };
+    vertex_buffer_t quad_vb = vertex_buffer_create(verts, sizeof(verts), BUFFER_USAGE_STATIC);
+
+    u32 indices[] = {
+        0, 1, 2,
+        2, 3, 1,
+    };
+    index_buffer_t quad_ib = index_buffer_create(indices, arr_len(indices), BUFFER_USAGE_STATIC);
+
+    u32 stream_size = desc.capacity * stride;
+    vertex_buffer_t stream = vertex_buffer_create(NULL, stream_size, BUFFER_USAGE_STREAM);
+
+    pipeline_t pipe = pipeline_create((pipeline_desc_t) {
+            .blend = {
+                .enabled = true,
+                .color_op = BLEND_OP_ADD,
+                .src_color_factor = BLEND_FACTOR_SRC_ALPHA,
+                .dst_color_factor = BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
+                .alpha_op = BLEND_OP_ADD,
+                .src_alpha_factor = BLEND_FACTOR_ONE,
+                .dst_alpha_factor = BLEND_FACTOR_ZERO,
+            },
+            .vertex_buffer = quad_vb,
+            .vertex_layout = {
+                .stride = sizeof(batch_vert_t),
+                .attribs = (vertex_attribute_t[]) {
+                    [0] = {
+                        .type = VERTEX_ATTRIB_TYPE_F32,
+                        .count = 2,
+                        .offset = offset(batch_vert_t, pos),
+                    },
+                    [1] = {
+                        .type = VERTEX_ATTRIB_TYPE_F32,
+                        .count = 2,
+                        .offset = offset(batch_vert_t, uv),
+                    },
+                },
+                .attrib_count = 2,
+            },
+            .instance_buffer = stream,
+            .instance_layout = instance_layout,
+        });
+
+    *batch = (batch_t) {
+        .quad_vb = quad_vb,
+        .quad_ib = quad_ib,
+        .pipe = pipe,
+
+        .stream = stream,
+        .stream_size = stream_size,
+
+        .staging = staging,
+        .capacity = desc.capacity,
+        .stride = stride,
+    };
+    return batch;
+}
+
+void batch_free(batch_t* batch) {
+    pipeline_destroy(batch->pipe);
+    vertex_buffer_destroy(batch->stream);
+    index_buffer_destroy(batch->quad_ib);
+    vertex_buffer_destroy(batch->quad_vb);
+}
+
+// Gives the stream buffer fresh storage. Draws still reading the old storage
+// keep it alive until they're done.
+static void batch_orphan(batch_t* batch) {
+    vertex_buffer_set_data(&batch->stream, NULL, batch->stream_size);
+    batch->stream_offset = 0;
+}
+
+void batch_frame_begin(batch_t* batch) {
+    batch->staging_count = 0;
+    batch_orphan(batch);
+    batch->stats = (batch_stats_t) {0};
+}
+
+batch_stats_t batch_stats(const batch_t* batch) {
+    return batch->stats;
+}
+
+void batch_set_shader(batch_t* batch, shader_t shader) {
+    if (batch->shader.handle == shader.handle) {
+        return;
+    }
+    batch_flush(batch);
+    batch->shader = shader;
+}
+
+void batch_set_texture(batch_t* batch, texture_t texture) {
+    if (batch->texture.handle == texture.handle) {
+        return;
+    }
+    batch_flush(batch);
+    batch->texture = texture;
+}
+
+void batch_quad(batch_t* batch, const void* instance) {
+    if (batch->staging_count == batch->capacity) {
+        batch_flush(batch);
+    }
+    memcpy(batch->staging + batch->staging_count * batch->stride, instance, batch->stride);
+    batch->staging_count++;
+}
+
+void batch_flush(batch_t* batch) {
+    if (batch->staging_count == 0) {
+        return;
+    }
+
+    u32 size = batch->staging_count * batch->stride;
+    if (batch->stream_offset + size > batch->stream_size) {
+        batch_orphan(batch);
+    }
+    vertex_buffer_sub_data(batch->stream, batch->stream_offset, batch->staging, size);
+
+    texture_bind(batch->texture, 0);
+    shader_use(batch->shader);
+
+    pipeline_set_instance_buffer(&batch->pipe, batch->stream, batch->stream_offset);
+    pipeline_bind(batch->pipe);
+    index_buffer_bind(batch->quad_ib);
+    draw_indexed_instanced(batch->quad_ib.count, 0, batch->staging_count);
+
+    batch->stats.quads += batch->staging_count;
+    batch->stats.flushes++;
+    batch->stats.bytes_uploaded += size;
+
+    batch->stream_offset += size;
+    batch->staging_count = 0;
+}
@@ -0,0 +1,217 @@
+#include "command_buffer.h"
+#include "core.h"
+#include "profiler.h"
+
+#include <string.h>
+
+// Maps the float onto an unsigned integer with the same order, negative
+// values included.
+static u32 depth_bits(f32 depth) {
+    u32 bits;
+    memcpy(&bits, &depth, sizeof(bits));
+    return (bits & 0x80000000) ? ~bits : bits | 0x80000000;
+}
+
+u64 draw_key(u8 pass, u8 pipeline, u8 shader, u8 texture, f32 depth) {
+    return ((u64) pass << DRAW_KEY_PASS_SHIFT) |
+        ((u64) pipeline << DRAW_KEY_PIPELINE_SHIFT) |
+        ((u64) shader << DRAW_KEY_SHADER_SHIFT) |
+        ((u64) texture << DRAW_KEY_TEXTURE_SHIFT) |
+        depth_bits(depth);
+}
+
+command_buffer_t* command_buffer_new(arena_t* arena, u32 capacity, u32 data_capacity) {
+    command_buffer_t* cb = arena_push_type(arena, command_buffer_t);
+    *cb = (command_buffer_t) {
+        .arena = arena,
+        .commands = arena_push_array(arena, draw_command_t, capacity),
+        .capacity = capacity,
+        .data = arena_push(arena, data_capacity),
+        .data_capacity = data_capacity,
+    };
+    return cb;
+}
+
+void command_buffer_clear(command_buffer_t* cb) {
+    cb->count = 0;
+    cb->data_size = 0;
+}
+
+// Makes room for 'count' more commands and a total payload of 'data_size'
+// bytes. Grown storage is left behind on the arena, which is cleared with the
+// frame anyway.
+static void command_buffer_reserve(command_buffer_t* cb, u32 count, u32 data_size) {
+    if (cb->count + count > cb->capacity) {
+        u32 capacity = cb->capacity > 0 ? cb->capacity : 256;
+        while (cb->count + count > capacity) {
+            capacity *= 2;
+        }
+        draw_command_t* commands = arena_push_array(cb->arena, draw_command_t, capacity);
+        memcpy(commands, cb->commands, cb->count * sizeof(draw_command_t));
+        cb->commands = commands;
+        cb->capacity = capacity;
+    }
+    if (data_size > cb->data_capacity) {
+        u32 data_capacity = cb->data_capacity > 0 ? cb->data_capacity : 4096;
+        while (data_size > data_capacity) {
+            data_capacity *= 2;
+        }
+        u8* data = arena_push(cb->arena, data_capacity);
+        memcpy(data, cb->data, cb->data_size);
+        cb->data = data;
+        cb->data_capacity = data_capacity;
+    }
+}
+
+// Payloads start 8 byte aligned.
+static u32 command_data_align(u32 size) {
+    return (size + 7) & ~7u;
+}
+
+void* command_buffer_push(command_buffer_t* cb, u64 key, u32 size) {
+    u32 offset = command_data_align(cb->data_size);
+    command_buffer_reserve(cb, 1, offset + size);
+
+    cb->commands[cb->count++] = (draw_command_t) {
+        .key = key,
+        .offset = offset,
+        .size = size,
+    };
+    cb->data_size = offset + size;
+    return cb->data + offset;
+}
+
+void command_buffer_append(command_buffer_t* dst, const command_buffer_t* src) {
+    u32 base = command_data_align(dst->data_size);
+    command_buffer_reserve(dst, src->count, base + src->data_size);
+
+    memcpy(dst->data + base, src->data, src->data_size);
+    for (u32 i = 0; i < src->count; i++) {
+        draw_command_t cmd = src->commands[i];
+        cmd.offset += base;
+        dst->commands[dst->count++] = cmd;
+    }
+    dst->data_size = base + src->data_size;
+}
+
+// Commands per block of the sort. Every block is histogrammed and scattered
+// by one job, in block order, which keeps the sort stable.
+#define COMMAND_SORT_BLOCK 8192
+
+typedef struct command_sort_t command_sort_t;
+struct command_sort_t {
+    const draw_command_t* src;
+    draw_command_t* dst;
+    u32 count;
+    u32 shift;
+    // Digit counts of every block, turned into its scatter offsets.
+    u32 (*offsets)[256];
+};
+
+static void command_sort_histogram(void* user_ptr, u32 begin, u32 end, u32 thread) {
+    (void) thread;
+    command_sort_t* sort = user_ptr;
+    for (u32 block = begin; block < end; block++) {
+        u32* offsets = sort->offsets[block];
+        memset(offsets, 0, 256 * sizeof(u32));
+        u32 last = min((block + 1) * COMMAND_SORT_BLOCK, sort->count);
+        for (u32 i = block * COMMAND_SORT_BLOCK; i < last; i++) {
+            offsets[(sort->src[i].key >> sort->shift) & 0xff]++;
+        }
+    }
+}
+
+static void command_sort_scatter(void* user_ptr, u32 begin, u32 end, u32 thread) {
+    (void) thread;
+    command_sort_t* sort = user_ptr;
+    for (u32 block = begin; block < end; block++) {
+        u32* offsets = sort->offsets[block];
+        u32 last = min((block + 1) * COMMAND_SORT_BLOCK, sort->count);
+        for (u32 i = block * COMMAND_SORT_BLOCK; i < last; i++) {
+            sort->dst[offsets[(sort->src[i].key >> sort->shift) & 0xff]++] = sort->src[i];
+        }
+    }
+}
+
+// Runs over the blocks on the job system if there's one.
+static void command_sort_blocks(job_system_t* js, u32 block_count, job_range_func_t func, command_sort_t* sort) {
+    if (js != NULL && block_count > 1) {
+        parallel_for(js, block_count, 1, func, sort);
+    } else {
+        func(sort, 0, block_count, 0);
+    }
+}
+
+void command_buffer_sort(command_buffer_t* cb, job_system_t* js) {
+    if (cb->count < 2) {
+        return;
+    }
+    PROFILE_BEGIN("command_buffer_sort");
+
+    // Bits which differ between any two keys.
+    u64 varying = 0;
+    for (u32 i = 1; i < cb->count; i++) {
+        varying |= cb->commands[i].key ^ cb->commands[0].key;
+    }
+
+    arena_temp_t scratch = arena_scratch(&cb->arena, 1);
+    u32 block_count = (cb->count + COMMAND_SORT_BLOCK - 1) / COMMAND_SORT_BLOCK;
+    command_sort_t sort = {
+        .src = cb->commands,
+        .dst = arena_push_array(scratch.arena, draw_command_t, cb->count),
+        .count = cb->count,
+        .offsets = arena_push(scratch.arena, block_count * sizeof(*sort.offsets)),
+    };
+    for (u32 shift = 0; shift < 64; shift += 8) {
+        if (((varying >> shift) & 0xff) == 0) {
+            continue;
+        }
+        sort.shift = shift;
+
+        command_sort_blocks(js, block_count, command_sort_histogram, &sort);
+        // Each digit goes after every smaller digit and, within the digit,
+        // after the earlier blocks.
+        u32 sum = 0;
+        for (u32 digit = 0; digit < 256; digit++) {
+            for (u32 block = 0; block < block_count; block++) {
+                u32 count = sort.offsets[block][digit];
+                sort.offsets[block][digit] = sum;
+                sum += count;
+            }
+        }
+        command_sort_blocks(js, block_count, command_sort_scatter, &sort);
+
+        draw_command_t* tmp = (draw_command_t*) sort.src;
+        sort.src = sort.dst;
+        sort.dst = tmp;
+    }
+    if (sort.src != cb->commands) {
+        memcpy(cb->commands, sort.src, cb->count * sizeof(draw_command_t));
+    }
+    arena_scratch_release(scratch);
+
+    PROFILE_END();
+}
+
+u32 command_buffer_pass(const command_buffer_t* cb, u8 pass, u32* first) {
+    u64 pass_key = (u64) pass << DRAW_KEY_PASS_SHIFT;
+    // First key of the pass, then first key after it.
+    u32 bounds[2];
+    for (u32 b = 0; b < 2; b++) {
+        u32 lo = 0;
+        u32 hi = cb->count;
+        while (lo < hi) {
+            u32 mid = lo + (hi - lo) / 2;
+            u64 key = cb->commands[mid].key;
+            b8 before = b == 0 ? key < pass_key : draw_key_pass(key) <= pass;
+            if (before) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        bounds[b] = lo;
+    }
+    *first = bounds[0];
+    return bounds[1] - bounds[0];
+}
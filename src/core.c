@@ -1,48 +1,413 @@
 #include "core.h"
+#include "profiler.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+
+#ifndef __EMSCRIPTEN__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // __EMSCRIPTEN__
+
 // -- Arena --------------------------------------------------------------------
 // Linear allocator
 // :arena
 
-// NOTE: Temporary implementation. Supposed to be a platform dependant
-// implementation using mmap. It also lacks alignment and all that fun stuff.
+#define align_up(V, ALIGN) (((V) + (ALIGN) - 1) & ~((u64) (ALIGN) - 1))
+
+// Debug builds commit page by page and keep an inaccessible page after the
+// arena, so writes past the used part of an arena fault right away.
+#ifndef NDEBUG
+#define ARENA_GUARD_PAGES
+#endif // NDEBUG
+
+// Shared by both arena implementations.
+typedef struct arena_accounting_t arena_accounting_t;
+struct arena_accounting_t {
+    u64 peak;
+    u64 push_count;
+#ifdef ARENA_STATS_ENABLED
+    // Index of the current tag.
+    u32 tag;
+    arena_tag_stats_t tags[ARENA_MAX_TAGS];
+    u32 tag_count;
+#endif // ARENA_STATS_ENABLED
+};
+
+static arena_accounting_t arena_accounting_init(void) {
+    arena_accounting_t accounting = {0};
+#ifdef ARENA_STATS_ENABLED
+    accounting.tags[0] = (arena_tag_stats_t) { .name = "untagged" };
+    accounting.tag_count = 1;
+#endif // ARENA_STATS_ENABLED
+    return accounting;
+}
+
+// 'size' includes alignment padding.
+static void arena_account(arena_accounting_t* accounting, u64 pos, u64 size) {
+    accounting->peak = max(accounting->peak, pos);
+    accounting->push_count++;
+#ifdef ARENA_STATS_ENABLED
+    accounting->tags[accounting->tag].bytes += size;
+    accounting->tags[accounting->tag].push_count++;
+#else
+    (void) size;
+#endif // ARENA_STATS_ENABLED
+}
+
+#ifdef __EMSCRIPTEN__
+
+// WebAssembly has no virtual memory so the arena is a chain of malloc'd
+// blocks. 'pos' is the position across all blocks, a block covers the range
+// starting at 'base'.
+
+#define ARENA_BLOCK_SIZE (64 << 10)
+
+typedef struct arena_block_t arena_block_t;
+struct arena_block_t {
+    arena_block_t* prev;
+    u64 base;
+    u64 cap;
+};
+
+struct arena_t {
+    arena_block_t* block;
+    u64 pos;
+    u64 cap;
+    arena_accounting_t accounting;
+};
+
+// Block data follows the header at the default alignment.
+#define ARENA_BLOCK_HEADER align_up(sizeof(arena_block_t), ARENA_DEFAULT_ALIGN)
+
+static arena_block_t* arena_block_new(arena_block_t* prev, u64 base, u64 cap) {
+    arena_block_t* block = malloc(ARENA_BLOCK_HEADER + cap);
+    if (block == NULL) {
+        printf("ERROR: Failed to allocate an arena block of %llu bytes.\n", (unsigned long long) cap);
+        fflush(stdout);
+        abort();
+    }
+    *block = (arena_block_t) {
+        .prev = prev,
+        .base = base,
+        .cap = cap,
+    };
+    return block;
+}
+
+arena_t* arena_new(u64 capacity) {
+    arena_t* arena = malloc(sizeof(arena_t));
+    *arena = (arena_t) {
+        .block = arena_block_new(NULL, 0, min(capacity, ARENA_BLOCK_SIZE)),
+        .pos = 0,
+        .cap = capacity,
+        .accounting = arena_accounting_init(),
+    };
+    return arena;
+}
+
+void arena_free(arena_t* arena) {
+    arena_block_t* block = arena->block;
+    while (block != NULL) {
+        arena_block_t* prev = block->prev;
+        free(block);
+        block = prev;
+    }
+    free(arena);
+}
+
+void* arena_push_aligned(arena_t* arena, u64 size, u64 align) {
+    arena_block_t* block = arena->block;
+    u8* data = (u8*) block + ARENA_BLOCK_HEADER;
+    u64 offset = align_up((u64) (data + (arena->pos - block->base)), align) - (u64) data;
+    if (offset + size > block->cap) {
+        // The rest of the current block is skipped.
+        u64 cap = max(ARENA_BLOCK_SIZE, size + align);
+        block = arena_block_new(block, block->base + block->cap, cap);
+        arena->block = block;
+        data = (u8*) block + ARENA_BLOCK_HEADER;
+        offset = align_up((u64) data, align) - (u64) data;
+    }
+
+    u64 end = block->base + offset + size;
+    arena_account(&arena->accounting, end, end - arena->pos);
+    arena->pos = end;
+    return data + offset;
+}
+
+void arena_pop(arena_t* arena, u64 size) {
+    arena->pos -= min(arena->pos, size);
+    while (arena->block->prev != NULL && arena->pos <= arena->block->base) {
+        arena_block_t* prev = arena->block->prev;
+        free(arena->block);
+        arena->block = prev;
+    }
+}
+
+void arena_clear(arena_t* arena) {
+    arena_pop(arena, arena->pos);
+}
+
+static u64 arena_committed(const arena_t* arena) {
+    u64 committed = 0;
+    for (const arena_block_t* block = arena->block; block != NULL; block = block->prev) {
+        committed += block->cap;
+    }
+    return committed;
+}
+
+#else
+
+// Address space is reserved up front and committed in chunks as the arena
+// grows. The arena header lives in the first committed chunk.
+
+#define ARENA_COMMIT_SIZE (64 << 10)
+// Committed memory above this is released by 'arena_clear'.
+#define ARENA_DECOMMIT_THRESHOLD (1 << 20)
 
 struct arena_t {
     u8* data;
-    u32 cap;
-    u32 pos;
+    u64 cap;
+    u64 pos;
+    // Bytes committed and committable, counted from the start of the
+    // reservation.
+    u64 committed;
+    u64 reserved;
+    arena_accounting_t accounting;
 };
 
-arena_t* arena_new(u32 capacity) {
-    arena_t* arena = malloc(sizeof(arena_t) + capacity);
+#define ARENA_HEADER_SIZE align_up(sizeof(arena_t), ARENA_DEFAULT_ALIGN)
+
+#ifdef ARENA_GUARD_PAGES
+static u64 arena_commit_size(void) {
+    static u64 page_size = 0;
+    if (page_size == 0) {
+        page_size = sysconf(_SC_PAGESIZE);
+    }
+    return page_size;
+}
+#define ARENA_GUARD_SIZE arena_commit_size()
+#else
+#define arena_commit_size() ((u64) ARENA_COMMIT_SIZE)
+#define ARENA_GUARD_SIZE 0
+#endif // ARENA_GUARD_PAGES
+
+static void arena_overflow(u64 size, u64 capacity) {
+    printf("ERROR: Arena overflow pushing %llu bytes (capacity %llu bytes).\n",
+            (unsigned long long) size, (unsigned long long) capacity);
+    fflush(stdout);
+    abort();
+}
+
+static void arena_commit(arena_t* arena, u64 size) {
+    u64 commit = align_up(size, arena_commit_size());
+    commit = min(commit, arena->reserved);
+    if (commit <= arena->committed) {
+        return;
+    }
+    if (mprotect((u8*) arena + arena->committed, commit - arena->committed, PROT_READ | PROT_WRITE) != 0) {
+        printf("ERROR: Failed to commit arena memory.\n");
+        fflush(stdout);
+        abort();
+    }
+    arena->committed = commit;
+}
+
+arena_t* arena_new(u64 capacity) {
+    u64 reserved = align_up(ARENA_HEADER_SIZE + capacity, arena_commit_size());
+    // The guard page is reserved but never committed.
+    void* base = mmap(NULL, reserved + ARENA_GUARD_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        printf("ERROR: Failed to reserve %llu bytes for an arena.\n", (unsigned long long) reserved);
+        fflush(stdout);
+        abort();
+    }
+    u64 committed = align_up(ARENA_HEADER_SIZE, arena_commit_size());
+    if (mprotect(base, committed, PROT_READ | PROT_WRITE) != 0) {
+        printf("ERROR: Failed to commit arena memory.\n");
+        fflush(stdout);
+        abort();
+    }
+
+    arena_t* arena = base;
     *arena = (arena_t) {
-        .data = (u8*) arena + sizeof(arena_t),
+        .data = (u8*) base + ARENA_HEADER_SIZE,
         .cap = capacity,
         .pos = 0,
+        .committed = committed,
+        .reserved = reserved,
+        .accounting = arena_accounting_init(),
     };
     return arena;
 }
 
 void arena_free(arena_t* arena) {
-    free(arena);
+    munmap(arena, arena->reserved + ARENA_GUARD_SIZE);
 }
 
-void* arena_push(arena_t* arena, u32 size) {
-    void* ptr = arena->data + arena->pos;
-    arena->pos += size;
-    return ptr;
+void* arena_push_aligned(arena_t* arena, u64 size, u64 align) {
+    u64 offset = align_up((u64) (arena->data + arena->pos), align) - (u64) arena->data;
+    u64 end = offset + size;
+    if (end > arena->cap) {
+        arena_overflow(size, arena->cap);
+    }
+    if (ARENA_HEADER_SIZE + end > arena->committed) {
+        arena_commit(arena, ARENA_HEADER_SIZE + end);
+    }
+
+    arena_account(&arena->accounting, end, end - arena->pos);
+    arena->pos = end;
+    return arena->data + offset;
 }
 
-void arena_pop(arena_t* arena, u32 size) {
+void arena_pop(arena_t* arena, u64 size) {
     arena->pos -= min(arena->pos, size);
 }
 
 void arena_clear(arena_t* arena) {
     arena->pos = 0;
+
+    u64 keep = align_up(max(ARENA_DECOMMIT_THRESHOLD, ARENA_HEADER_SIZE), arena_commit_size());
+    if (arena->committed > keep) {
+        u8* start = (u8*) arena + keep;
+        u64 size = arena->committed - keep;
+        // MADV_DONTNEED drops the pages; PROT_NONE makes stray writes fault.
+        madvise(start, size, MADV_DONTNEED);
+        mprotect(start, size, PROT_NONE);
+        arena->committed = keep;
+    }
+}
+
+static u64 arena_committed(const arena_t* arena) {
+    return arena->committed;
+}
+
+#endif // __EMSCRIPTEN__
+
+const char* arena_set_tag(arena_t* arena, const char* tag) {
+#ifdef ARENA_STATS_ENABLED
+    arena_accounting_t* accounting = &arena->accounting;
+    const char* prev = accounting->tags[accounting->tag].name;
+
+    u32 index = 0;
+    for (u32 i = 0; i < accounting->tag_count; i++) {
+        if (accounting->tags[i].name == tag || strcmp(accounting->tags[i].name, tag) == 0) {
+            index = i;
+            break;
+        }
+    }
+    if (index == 0 && strcmp(tag, accounting->tags[0].name) != 0) {
+        // Falls back to "untagged" when out of tags.
+        if (accounting->tag_count < ARENA_MAX_TAGS) {
+            index = accounting->tag_count++;
+            accounting->tags[index] = (arena_tag_stats_t) { .name = tag };
+        }
+    }
+    accounting->tag = index;
+
+    return prev;
+#else
+    (void) arena;
+    (void) tag;
+    return NULL;
+#endif // ARENA_STATS_ENABLED
+}
+
+arena_stats_t arena_stats(const arena_t* arena) {
+    arena_stats_t stats = {
+        .used = arena->pos,
+        .peak = arena->accounting.peak,
+        .committed = arena_committed(arena),
+        .capacity = arena->cap,
+        .push_count = arena->accounting.push_count,
+    };
+#ifdef ARENA_STATS_ENABLED
+    memcpy(stats.tags, arena->accounting.tags, sizeof(stats.tags));
+    stats.tag_count = arena->accounting.tag_count;
+#endif // ARENA_STATS_ENABLED
+    return stats;
+}
+
+void arena_report(const arena_t* arena, const char* name) {
+    arena_stats_t stats = arena_stats(arena);
+    printf("Arena '%s': %llu bytes used, %llu bytes peak, %llu KiB committed, %llu KiB capacity, %llu pushes\n",
+            name,
+            (unsigned long long) stats.used,
+            (unsigned long long) stats.peak,
+            (unsigned long long) stats.committed >> 10,
+            (unsigned long long) stats.capacity >> 10,
+            (unsigned long long) stats.push_count);
+    for (u32 i = 0; i < stats.tag_count; i++) {
+        arena_tag_stats_t tag = stats.tags[i];
+        if (tag.push_count == 0) {
+            continue;
+        }
+        printf("    %-24s %10llu bytes %8llu pushes\n", tag.name,
+                (unsigned long long) tag.bytes, (unsigned long long) tag.push_count);
+    }
+}
+
+void* arena_push(arena_t* arena, u64 size) {
+    return arena_push_aligned(arena, size, ARENA_DEFAULT_ALIGN);
+}
+
+u64 arena_pos(const arena_t* arena) {
+    return arena->pos;
+}
+
+void arena_pop_to(arena_t* arena, u64 pos) {
+    if (pos < arena->pos) {
+        arena_pop(arena, arena->pos - pos);
+    }
+}
+
+arena_temp_t arena_temp_begin(arena_t* arena) {
+    return (arena_temp_t) {
+        .arena = arena,
+        .pos = arena_pos(arena),
+    };
+}
+
+void arena_temp_end(arena_temp_t temp) {
+    arena_pop_to(temp.arena, temp.pos);
+}
+
+// Two scratch arenas per thread are enough as long as every function passes
+// the arenas it allocates results in as conflicts. Scratch arenas live as
+// long as the thread.
+#define SCRATCH_ARENA_COUNT 2
+#define SCRATCH_ARENA_CAPACITY (256ull << 20)
+
+static thread_local arena_t* scratch_arenas[SCRATCH_ARENA_COUNT];
+
+arena_temp_t arena_scratch(arena_t* const* conflicts, u32 conflict_count) {
+    for (u32 i = 0; i < SCRATCH_ARENA_COUNT; i++) {
+        if (scratch_arenas[i] == NULL) {
+            scratch_arenas[i] = arena_new(SCRATCH_ARENA_CAPACITY);
+        }
+
+        b8 conflicting = false;
+        for (u32 j = 0; j < conflict_count; j++) {
+            if (conflicts[j] == scratch_arenas[i]) {
+                conflicting = true;
+                break;
+            }
+        }
+        if (!conflicting) {
+            return arena_temp_begin(scratch_arenas[i]);
+        }
+    }
+
+    printf("ERROR: Every scratch arena conflicts.\n");
+    fflush(stdout);
+    abort();
 }
 
 // -- String -------------------------------------------------------------------
@@ -61,20 +426,521 @@ const char* str_to_cstr(arena_t* arena, str_t str) {
 }
 
 str_t str_read_file(arena_t* arena, str_t filename) {
-    const char* cstr_filename = str_to_cstr(arena, filename);
+    PROFILE_BEGIN("str_read_file");
+    arena_temp_t scratch = arena_scratch(&arena, 1);
+    const char* cstr_filename = str_to_cstr(scratch.arena, filename);
     FILE *fp = fopen(cstr_filename, "rb");
-    // Pop off the cstr_filename from the arena since it's no longer needed.
-    arena_pop(arena, filename.len + 1);
+    arena_scratch_release(scratch);
     if (fp == NULL) {
         printf("ERROR: Failed to open file '%.*s'.\n", str_arg(filename));
+        PROFILE_END();
         return (str_t) {0};
     }
 
-    fseek(fp, 0, SEEK_END);
-    u32 len = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
+    i64 len = -1;
+    if (fseek(fp, 0, SEEK_END) == 0) {
+        len = ftell(fp);
+    }
+    if (len < 0 || len > UINT32_MAX || fseek(fp, 0, SEEK_SET) != 0) {
+        printf("ERROR: Failed to get the size of file '%.*s'.\n", str_arg(filename));
+        fclose(fp);
+        PROFILE_END();
+        return (str_t) {0};
+    }
+
+    arena_temp_t content_temp = arena_temp_begin(arena);
     u8* content = arena_push(arena, len);
-    fread(content, sizeof(u8), len, fp);
+    u64 read = fread(content, sizeof(u8), len, fp);
+    fclose(fp);
+    if (read != (u64) len) {
+        printf("ERROR: Failed to read file '%.*s'.\n", str_arg(filename));
+        arena_temp_end(content_temp);
+        PROFILE_END();
+        return (str_t) {0};
+    }
 
+    PROFILE_END();
     return str(content, len);
 }
+
+u32 str_hash(str_t str) {
+    // https://en.wikipedia.org/wiki/Fowler%E2%80%93Noll%E2%80%93Vo_hash_function
+    u32 hash = 2166136261u;
+    for (u32 i = 0; i < str.len; i++) {
+        hash ^= str.data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+u64 str_hash64(str_t str) {
+    u64 hash = 14695981039346656037ull;
+    for (u32 i = 0; i < str.len; i++) {
+        hash ^= str.data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// -- File ---------------------------------------------------------------------
+// :file
+
+// Reads the file into a malloc'd buffer.
+static file_map_t file_read_buffered(const char* filename, str_t name) {
+    FILE* fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        printf("ERROR: Failed to open file '%.*s'.\n", str_arg(name));
+        return (file_map_t) {0};
+    }
+
+    i64 len = -1;
+    if (fseek(fp, 0, SEEK_END) == 0) {
+        len = ftell(fp);
+    }
+    if (len < 0 || len > UINT32_MAX || fseek(fp, 0, SEEK_SET) != 0) {
+        printf("ERROR: Failed to get the size of file '%.*s'.\n", str_arg(name));
+        fclose(fp);
+        return (file_map_t) {0};
+    }
+
+    // malloc(0) may return NULL so there's always at least one byte.
+    u8* content = malloc(max(len, 1));
+    u64 read = fread(content, sizeof(u8), len, fp);
+    fclose(fp);
+    if (read != (u64) len) {
+        printf("ERROR: Failed to read file '%.*s'.\n", str_arg(name));
+        free(content);
+        return (file_map_t) {0};
+    }
+
+    return (file_map_t) {
+        .content = str(content, len),
+        .valid = true,
+        .mapped = false,
+    };
+}
+
+file_map_t file_map(str_t filename) {
+    PROFILE_BEGIN("file_map");
+    arena_temp_t scratch = arena_scratch(NULL, 0);
+    const char* cstr_filename = str_to_cstr(scratch.arena, filename);
+
+#ifdef __EMSCRIPTEN__
+    file_map_t map = file_read_buffered(cstr_filename, filename);
+#else
+    file_map_t map = {0};
+    i32 fd = open(cstr_filename, O_RDONLY);
+    struct stat st;
+    if (fd == -1) {
+        printf("ERROR: Failed to open file '%.*s'.\n", str_arg(filename));
+    } else if (fstat(fd, &st) != 0 || st.st_size > UINT32_MAX) {
+        printf("ERROR: Failed to get the size of file '%.*s'.\n", str_arg(filename));
+    } else if (st.st_size == 0 || !S_ISREG(st.st_mode)) {
+        // Empty files can't be mapped and special files have no usable size.
+        map = file_read_buffered(cstr_filename, filename);
+    } else {
+        void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            map = file_read_buffered(cstr_filename, filename);
+        } else {
+            map = (file_map_t) {
+                .content = str(data, st.st_size),
+                .valid = true,
+                .mapped = true,
+            };
+        }
+    }
+    // The mapping stays valid after the file is closed.
+    if (fd != -1) {
+        close(fd);
+    }
+#endif // __EMSCRIPTEN__
+
+    arena_scratch_release(scratch);
+    PROFILE_END();
+    return map;
+}
+
+void file_unmap(file_map_t* map) {
+    if (!map->valid) {
+        return;
+    }
+#ifdef __EMSCRIPTEN__
+    free((void*) map->content.data);
+#else
+    if (map->mapped) {
+        munmap((void*) map->content.data, map->content.len);
+    } else {
+        free((void*) map->content.data);
+    }
+#endif // __EMSCRIPTEN__
+    *map = (file_map_t) {0};
+}
+
+// -- Threads ------------------------------------------------------------------
+// :thread
+
+struct thread_t {
+    pthread_t handle;
+    thread_func_t func;
+    void* arg;
+};
+
+static void* thread_start(void* arg) {
+    thread_t* thread = arg;
+    thread->func(thread->arg);
+    return NULL;
+}
+
+thread_t* thread_create(thread_func_t func, void* arg) {
+    thread_t* thread = malloc(sizeof(thread_t));
+    *thread = (thread_t) {
+        .func = func,
+        .arg = arg,
+    };
+    if (pthread_create(&thread->handle, NULL, thread_start, thread) != 0) {
+        free(thread);
+        return NULL;
+    }
+    return thread;
+}
+
+void thread_join(thread_t* thread) {
+    pthread_join(thread->handle, NULL);
+    free(thread);
+}
+
+struct semaphore_t {
+    sem_t handle;
+};
+
+semaphore_t* semaphore_new(u32 count) {
+    semaphore_t* semaphore = malloc(sizeof(semaphore_t));
+    sem_init(&semaphore->handle, 0, count);
+    return semaphore;
+}
+
+void semaphore_free(semaphore_t* semaphore) {
+    sem_destroy(&semaphore->handle);
+    free(semaphore);
+}
+
+void semaphore_wait(semaphore_t* semaphore) {
+    // Retry if interrupted by a signal.
+    while (sem_wait(&semaphore->handle) != 0) {}
+}
+
+void semaphore_post(semaphore_t* semaphore) {
+    sem_post(&semaphore->handle);
+}
+
+u32 cpu_count(void) {
+#ifdef __EMSCRIPTEN__
+    return 1;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? count : 1;
+#endif // __EMSCRIPTEN__
+}
+
+// -- Jobs ---------------------------------------------------------------------
+// :job
+
+#define JOB_CACHE_LINE 64
+
+typedef struct job_t job_t;
+struct job_t {
+    // Exactly one of the two is set.
+    job_func_t func;
+    job_range_func_t range_func;
+    void* user_ptr;
+    job_counter_t* counter;
+    u32 begin;
+    u32 end;
+    u32 grain;
+};
+
+// Chase-Lev deque. The owner pushes and pops at 'bottom', thieves take from
+// 'top'. Slots are copied field by field with atomic loads and stores since a
+// thief may read a slot the owner is overwriting. It then fails to claim it
+// and throws the copy away.
+typedef struct job_deque_t job_deque_t;
+struct job_deque_t {
+    // Apart so thieves and the owner don't keep invalidating each other.
+    __attribute__((aligned(JOB_CACHE_LINE))) i64 top;
+    __attribute__((aligned(JOB_CACHE_LINE))) i64 bottom;
+    job_t jobs[JOB_DEQUE_SIZE];
+};
+
+typedef struct job_worker_t job_worker_t;
+struct job_worker_t {
+    job_system_t* js;
+    u32 thread;
+};
+
+struct job_system_t {
+    u32 thread_count;
+    thread_t* threads[JOB_MAX_THREADS];
+    job_worker_t workers[JOB_MAX_THREADS];
+    job_deque_t* deques[JOB_MAX_THREADS];
+
+    // Idle workers sleep on the semaphore. Submitting wakes one if any sleep.
+    semaphore_t* wake;
+    u32 sleeping;
+    b8 quit;
+};
+
+static thread_local u32 job_thread = 0;
+
+static void job_store(job_t* slot, job_t job) {
+    __atomic_store_n(&slot->func, job.func, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->range_func, job.range_func, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->user_ptr, job.user_ptr, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->counter, job.counter, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->begin, job.begin, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->end, job.end, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->grain, job.grain, __ATOMIC_RELAXED);
+}
+
+static job_t job_load(job_t* slot) {
+    return (job_t) {
+        .func = __atomic_load_n(&slot->func, __ATOMIC_RELAXED),
+        .range_func = __atomic_load_n(&slot->range_func, __ATOMIC_RELAXED),
+        .user_ptr = __atomic_load_n(&slot->user_ptr, __ATOMIC_RELAXED),
+        .counter = __atomic_load_n(&slot->counter, __ATOMIC_RELAXED),
+        .begin = __atomic_load_n(&slot->begin, __ATOMIC_RELAXED),
+        .end = __atomic_load_n(&slot->end, __ATOMIC_RELAXED),
+        .grain = __atomic_load_n(&slot->grain, __ATOMIC_RELAXED),
+    };
+}
+
+// Owner only. Returns false if the deque is full.
+static b8 job_deque_push(job_deque_t* dq, job_t job) {
+    i64 b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED);
+    i64 t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+    if (b - t >= JOB_DEQUE_SIZE) {
+        return false;
+    }
+    job_store(&dq->jobs[b & (JOB_DEQUE_SIZE - 1)], job);
+    __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Owner only.
+static b8 job_deque_pop(job_deque_t* dq, job_t* job) {
+    i64 b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&dq->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    i64 t = __atomic_load_n(&dq->top, __ATOMIC_RELAXED);
+    if (t > b) {
+        __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    *job = job_load(&dq->jobs[b & (JOB_DEQUE_SIZE - 1)]);
+    if (t == b) {
+        // Last job, race the thieves for it.
+        b8 won = __atomic_compare_exchange_n(&dq->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+        __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+        return won;
+    }
+    return true;
+}
+
+static b8 job_deque_steal(job_deque_t* dq, job_t* job) {
+    i64 t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    i64 b = __atomic_load_n(&dq->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b) {
+        return false;
+    }
+
+    job_t stolen = job_load(&dq->jobs[t & (JOB_DEQUE_SIZE - 1)]);
+    if (!__atomic_compare_exchange_n(&dq->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return false;
+    }
+    *job = stolen;
+    return true;
+}
+
+static void job_run(job_system_t* js, job_t job, u32 thread);
+
+// Pushes onto the deque of the calling thread.
+static void job_push(job_system_t* js, job_t job) {
+    __atomic_add_fetch(&job.counter->pending, 1, __ATOMIC_RELAXED);
+    if (!job_deque_push(js->deques[job_thread], job)) {
+        job_run(js, job, job_thread);
+        return;
+    }
+
+    // Pairs with the fence of a worker going to sleep, so either it sees the
+    // job or this sees it sleeping.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&js->sleeping, __ATOMIC_RELAXED) > 0) {
+        semaphore_post(js->wake);
+    }
+}
+
+static void job_run(job_system_t* js, job_t job, u32 thread) {
+    if (job.func != NULL) {
+        job.func(job.user_ptr, thread);
+    } else {
+        // Keep half of the range and leave the other half to be stolen.
+        while (job.end - job.begin > job.grain) {
+            job_t right = job;
+            right.begin = job.begin + (job.end - job.begin) / 2;
+            job.end = right.begin;
+            job_push(js, right);
+        }
+        job.range_func(job.user_ptr, job.begin, job.end, thread);
+    }
+    __atomic_sub_fetch(&job.counter->pending, 1, __ATOMIC_RELEASE);
+}
+
+// Takes a job from the own deque, otherwise steals one.
+static b8 job_find(job_system_t* js, u32 thread, job_t* job) {
+    if (job_deque_pop(js->deques[thread], job)) {
+        return true;
+    }
+    for (u32 i = 1; i < js->thread_count; i++) {
+        u32 victim = (thread + i) % js->thread_count;
+        if (job_deque_steal(js->deques[victim], job)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static b8 job_any_queued(job_system_t* js) {
+    for (u32 i = 0; i < js->thread_count; i++) {
+        job_deque_t* dq = js->deques[i];
+        if (__atomic_load_n(&dq->top, __ATOMIC_ACQUIRE) < __atomic_load_n(&dq->bottom, __ATOMIC_ACQUIRE)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Tries to find work for a while before going to sleep.
+#define JOB_IDLE_SPINS 64
+
+static void job_worker(void* arg) {
+    job_worker_t* worker = arg;
+    job_system_t* js = worker->js;
+    job_thread = worker->thread;
+
+    u32 idle = 0;
+    while (!__atomic_load_n(&js->quit, __ATOMIC_ACQUIRE)) {
+        job_t job;
+        if (job_find(js, worker->thread, &job)) {
+            job_run(js, job, worker->thread);
+            idle = 0;
+            continue;
+        }
+        if (++idle < JOB_IDLE_SPINS) {
+            sched_yield();
+            continue;
+        }
+
+        __atomic_add_fetch(&js->sleeping, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (!job_any_queued(js) && !__atomic_load_n(&js->quit, __ATOMIC_ACQUIRE)) {
+            semaphore_wait(js->wake);
+        }
+        __atomic_sub_fetch(&js->sleeping, 1, __ATOMIC_SEQ_CST);
+        idle = 0;
+    }
+}
+
+job_system_t* job_system_new(u32 worker_count) {
+    job_system_t* js = malloc(sizeof(job_system_t));
+    *js = (job_system_t) {
+        .wake = semaphore_new(0),
+    };
+    worker_count = min(worker_count, JOB_MAX_THREADS - 1);
+    for (u32 i = 0; i < worker_count + 1; i++) {
+        void* deque = NULL;
+        if (posix_memalign(&deque, JOB_CACHE_LINE, sizeof(job_deque_t)) != 0) {
+            printf("ERROR: Failed to allocate job deque.\n");
+            fflush(stdout);
+            abort();
+        }
+        memset(deque, 0, sizeof(job_deque_t));
+        js->deques[i] = deque;
+    }
+    job_thread = 0;
+
+    // Workers steal from every deque, so the count is final before the first
+    // one starts. Deques of workers which failed to start simply stay empty.
+    js->thread_count = worker_count + 1;
+    for (u32 i = 1; i <= worker_count; i++) {
+        js->workers[i] = (job_worker_t) {
+            .js = js,
+            .thread = i,
+        };
+        thread_t* thread = thread_create(job_worker, &js->workers[i]);
+        if (thread == NULL) {
+            break;
+        }
+        js->threads[i] = thread;
+    }
+
+    return js;
+}
+
+void job_system_free(job_system_t* js) {
+    __atomic_store_n(&js->quit, true, __ATOMIC_RELEASE);
+    for (u32 i = 1; i < js->thread_count; i++) {
+        semaphore_post(js->wake);
+    }
+    for (u32 i = 1; i < js->thread_count; i++) {
+        if (js->threads[i] != NULL) {
+            thread_join(js->threads[i]);
+        }
+    }
+    for (u32 i = 0; i < JOB_MAX_THREADS; i++) {
+        free(js->deques[i]);
+    }
+    semaphore_free(js->wake);
+    free(js);
+}
+
+u32 job_system_thread_count(const job_system_t* js) {
+    return js->thread_count;
+}
+
+void job_submit(job_system_t* js, job_func_t func, void* user_ptr, job_counter_t* counter) {
+    job_push(js, (job_t) {
+            .func = func,
+            .user_ptr = user_ptr,
+            .counter = counter,
+        });
+}
+
+void job_wait(job_system_t* js, job_counter_t* counter) {
+    u32 thread = job_thread;
+    while (__atomic_load_n(&counter->pending, __ATOMIC_ACQUIRE) > 0) {
+        job_t job;
+        if (job_find(js, thread, &job)) {
+            job_run(js, job, thread);
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+void parallel_for(job_system_t* js, u32 count, u32 grain, job_range_func_t func, void* user_ptr) {
+    if (count == 0) {
+        return;
+    }
+    job_counter_t counter = {0};
+    job_push(js, (job_t) {
+            .range_func = func,
+            .user_ptr = user_ptr,
+            .counter = &counter,
+            .begin = 0,
+            .end = count,
+            .grain = max(grain, 1),
+        });
+    job_wait(js, &counter);
+}
@@ -2,7 +2,7 @@
 // Desktop implementation of the program header file.
 //
 
-#ifndef __EMSCRIPTEN__
+#if !defined(__EMSCRIPTEN__) && !defined(HEADLESS)
 
 #include "program.h"
 #include "core.h"
@@ -27,10 +27,13 @@ static void internal_resize_cb(GLFWwindow* window, int width, int height) {
 }
 
 renderer_t* renderer_new(u32 width, u32 height, const char *title)  {
-    renderer_t* rend = malloc(sizeof(renderer_t));
-
     dt_renderer_t* dt = malloc(sizeof(dt_renderer_t));
-    rend->data = dt;
+
+    renderer_t* rend = malloc(sizeof(renderer_t));
+    *rend = (renderer_t) {
+        .data = dt,
+    };
+    renderer_frames_init(rend);
 
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
@@ -54,6 +57,7 @@ void renderer_free(renderer_t* renderer) {
     dt_renderer_t* dt = renderer->data;
     glfwDestroyWindow(dt->window);
     glfwTerminate();
+    renderer_frames_free(renderer);
 
     free(dt);
     free(renderer);
@@ -72,6 +76,7 @@ void renderer_run(renderer_t* renderer) {
         renderer->resize_cb(renderer, w, h);
     }
     while (!glfwWindowShouldClose(dt->window)) {
+        renderer_frame_begin(renderer);
         if (renderer->update_cb != NULL) {
             renderer->update_cb(renderer);
         }
@@ -83,4 +88,4 @@ f32 get_time(void) {
     return glfwGetTime();
 }
 
-#endif
+#endif // !__EMSCRIPTEN__ && !HEADLESS
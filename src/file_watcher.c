@@ -0,0 +1,194 @@
+#include "file_watcher.h"
+#include "core.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/inotify.h>
+#endif // __linux__
+
+typedef struct watched_file_t watched_file_t;
+struct watched_file_t {
+    char name[128];
+    u64 mtime_ns;
+    u64 size;
+};
+
+struct file_watcher_t {
+    char dir[512];
+    // -1 when polling.
+    i32 inotify_fd;
+
+    // Polling fallback
+    f64 next_poll_ms;
+    watched_file_t files[FILE_WATCHER_MAX_FILES];
+    u32 file_count;
+};
+
+static f64 watcher_now_ms(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+static u64 stat_mtime_ns(const struct stat* st) {
+#ifdef __APPLE__
+    return (u64) st->st_mtimespec.tv_sec * 1000000000ull + st->st_mtimespec.tv_nsec;
+#else
+    return (u64) st->st_mtim.tv_sec * 1000000000ull + st->st_mtim.tv_nsec;
+#endif // __APPLE__
+}
+
+// Milliseconds since the file was last modified.
+static f64 file_age_ms(const file_watcher_t* watcher, const char* name) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", watcher->dir, name);
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return 0.0;
+    }
+    f64 age = watcher_now_ms(CLOCK_REALTIME) - stat_mtime_ns(&st) * 1e-6;
+    return age > 0.0 ? age : 0.0;
+}
+
+static void change_push(const file_watcher_t* watcher, arena_t* arena, file_change_list_t* list, const char* name) {
+    u32 len = strlen(name);
+    for (u32 i = 0; i < list->count; i++) {
+        str_t other = list->changes[i].name;
+        if (other.len == len && memcmp(other.data, name, len) == 0) {
+            return;
+        }
+    }
+
+    if (list->count == FILE_WATCHER_MAX_FILES) {
+        return;
+    }
+    if (list->changes == NULL) {
+        list->changes = arena_push_array(arena, file_change_t, FILE_WATCHER_MAX_FILES);
+    }
+    u8* data = arena_push(arena, len + 1);
+    memcpy(data, name, len + 1);
+    list->changes[list->count] = (file_change_t) {
+        .name = str(data, len),
+        .age_ms = file_age_ms(watcher, name),
+    };
+    list->count++;
+}
+
+// Stats every file in the directory. Only reports changes when 'report' is
+// set so the first scan just records the initial state.
+static void watcher_scan(file_watcher_t* watcher, arena_t* arena, file_change_list_t* list, b8 report) {
+    DIR* dir = opendir(watcher->dir);
+    if (dir == NULL) {
+        return;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s", watcher->dir, entry->d_name);
+        struct stat st;
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        if (strlen(entry->d_name) >= sizeof(watcher->files[0].name)) {
+            continue;
+        }
+
+        watched_file_t* file = NULL;
+        for (u32 i = 0; i < watcher->file_count; i++) {
+            if (strcmp(watcher->files[i].name, entry->d_name) == 0) {
+                file = &watcher->files[i];
+                break;
+            }
+        }
+        if (file == NULL) {
+            if (watcher->file_count == FILE_WATCHER_MAX_FILES) {
+                continue;
+            }
+            file = &watcher->files[watcher->file_count++];
+            strcpy(file->name, entry->d_name);
+        } else if (file->mtime_ns == stat_mtime_ns(&st) && file->size == (u64) st.st_size) {
+            continue;
+        }
+
+        file->mtime_ns = stat_mtime_ns(&st);
+        file->size = st.st_size;
+        if (report) {
+            change_push(watcher, arena, list, file->name);
+        }
+    }
+    closedir(dir);
+}
+
+file_watcher_t* file_watcher_new(const char* dir) {
+    struct stat st;
+    if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode) || strlen(dir) >= sizeof(((file_watcher_t*) 0)->dir)) {
+        printf("ERROR: Can't watch directory '%s'.\n", dir);
+        return NULL;
+    }
+
+    file_watcher_t* watcher = malloc(sizeof(file_watcher_t));
+    *watcher = (file_watcher_t) {
+        .inotify_fd = -1,
+    };
+    strcpy(watcher->dir, dir);
+
+#ifdef __linux__
+    // Editors either write in place or rename a temporary file over the
+    // original, which are the two events watched.
+    watcher->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watcher->inotify_fd != -1 &&
+            inotify_add_watch(watcher->inotify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+        close(watcher->inotify_fd);
+        watcher->inotify_fd = -1;
+    }
+#endif // __linux__
+
+    if (watcher->inotify_fd == -1) {
+        watcher_scan(watcher, NULL, NULL, false);
+    }
+
+    return watcher;
+}
+
+void file_watcher_free(file_watcher_t* watcher) {
+    if (watcher->inotify_fd != -1) {
+        close(watcher->inotify_fd);
+    }
+    free(watcher);
+}
+
+file_change_list_t file_watcher_poll(file_watcher_t* watcher, arena_t* arena) {
+    file_change_list_t list = {0};
+
+#ifdef __linux__
+    if (watcher->inotify_fd != -1) {
+        u8 buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        i64 len;
+        while ((len = read(watcher->inotify_fd, buffer, sizeof(buffer))) > 0) {
+            for (i64 offset = 0; offset < len;) {
+                const struct inotify_event* event = (const struct inotify_event*) (buffer + offset);
+                if (event->len > 0) {
+                    change_push(watcher, arena, &list, event->name);
+                }
+                offset += sizeof(struct inotify_event) + event->len;
+            }
+        }
+        return list;
+    }
+#endif // __linux__
+
+    f64 now = watcher_now_ms(CLOCK_MONOTONIC);
+    if (now >= watcher->next_poll_ms) {
+        watcher->next_poll_ms = now + FILE_WATCHER_POLL_INTERVAL_MS;
+        watcher_scan(watcher, arena, &list, true);
+    }
+    return list;
+}
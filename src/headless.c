@@ -0,0 +1,319 @@
+//
+// Headless implementation of the program header file. Renders into an
+// offscreen surface of a fixed size without any window system, which makes it
+// usable on GPU-less machines through Mesa's software rasterizer.
+//
+// The context is created with EGL by default, preferring Mesa's surfaceless
+// platform. Defining 'HEADLESS_OSMESA' uses OSMesa instead.
+//
+// Behaviour is controlled through environment variables:
+//   HEADLESS_FRAMES - Number of frames 'renderer_run' renders. Defaults to 60.
+//   HEADLESS_OUTPUT - If set, the last frame is written to this path as a PPM.
+//
+// Defining 'HEADLESS_FIXED_TIMESTEP' to a number of seconds makes 'get_time'
+// advance by exactly that much every presented frame instead of following
+// the wall clock, so every run renders the same frames.
+//
+
+#ifdef HEADLESS
+
+#include "program.h"
+#include "core.h"
+#include "render_api.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <glad/gl.h>
+
+#ifdef HEADLESS_OSMESA
+#include <GL/osmesa.h>
+#else
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif // HEADLESS_OSMESA
+
+#define HEADLESS_DEFAULT_FRAMES 60
+
+typedef struct hl_renderer_t hl_renderer_t;
+struct hl_renderer_t {
+    u32 width;
+    u32 height;
+#ifdef HEADLESS_OSMESA
+    OSMesaContext context;
+    u8* color_buffer;
+#else
+    EGLDisplay display;
+    EGLSurface surface;
+    EGLContext context;
+#endif // HEADLESS_OSMESA
+};
+
+static f64 monotonic_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (f64) ts.tv_sec + (f64) ts.tv_nsec * 1e-9;
+}
+
+// Start of the clock used by 'get_time'. Set when the renderer is created.
+static f64 hl_start_time = 0.0;
+// Frames presented so far.
+static u64 hl_frame_index = 0;
+
+#ifdef HEADLESS_OSMESA
+
+static b8 context_create(hl_renderer_t* hl) {
+    hl->context = OSMesaCreateContextAttribs((i32[]) {
+            OSMESA_FORMAT,                OSMESA_RGBA,
+            OSMESA_DEPTH_BITS,            0,
+            OSMESA_PROFILE,               OSMESA_CORE_PROFILE,
+            OSMESA_CONTEXT_MAJOR_VERSION, 4,
+            OSMESA_CONTEXT_MINOR_VERSION, 3,
+            0,
+        }, NULL);
+    if (hl->context == NULL) {
+        printf("ERROR: OSMesaCreateContextAttribs\n");
+        return false;
+    }
+
+    hl->color_buffer = malloc(hl->width * hl->height * 4);
+    if (hl->color_buffer == NULL) {
+        printf("ERROR: Failed to allocate the color buffer.\n");
+        return false;
+    }
+    if (!OSMesaMakeCurrent(hl->context, hl->color_buffer, GL_UNSIGNED_BYTE, hl->width, hl->height)) {
+        printf("ERROR: OSMesaMakeCurrent\n");
+        return false;
+    }
+
+    if (!gladLoadGL((GLADloadfunc) OSMesaGetProcAddress)) {
+        printf("ERROR: GLAD failed to load OpenGL functions.\n");
+        return false;
+    }
+
+    return true;
+}
+
+// Also releases a partially created context.
+static void context_destroy(hl_renderer_t* hl) {
+    if (hl->context != NULL) {
+        OSMesaDestroyContext(hl->context);
+    }
+    free(hl->color_buffer);
+}
+
+static void context_present(hl_renderer_t* hl) {
+    (void) hl;
+    glFinish();
+}
+
+#else
+
+static EGLDisplay display_get(void) {
+    // Mesa's surfaceless platform works without X11, Wayland or a GPU.
+    const char* client_extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (client_extensions != NULL && strstr(client_extensions, "EGL_MESA_platform_surfaceless") != NULL) {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (get_platform_display != NULL) {
+            EGLDisplay display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+            if (display != EGL_NO_DISPLAY) {
+                return display;
+            }
+        }
+    }
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+static b8 context_create(hl_renderer_t* hl) {
+    hl->display = display_get();
+    if (hl->display == EGL_NO_DISPLAY) {
+        printf("ERROR: eglGetDisplay\n");
+        return false;
+    }
+
+    i32 major;
+    i32 minor;
+    if (!eglInitialize(hl->display, &major, &minor)) {
+        printf("ERROR: eglInitialize\n");
+        return false;
+    }
+
+    EGLConfig config;
+    i32 num_configs;
+    if (!eglChooseConfig(hl->display, (i32[]) {
+            EGL_SURFACE_TYPE,    EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_RED_SIZE,        8,
+            EGL_GREEN_SIZE,      8,
+            EGL_BLUE_SIZE,       8,
+            EGL_ALPHA_SIZE,      8,
+            EGL_NONE
+        }, &config, 1, &num_configs) || num_configs == 0) {
+        printf("ERROR: eglChooseConfig\n");
+        return false;
+    }
+
+    hl->surface = eglCreatePbufferSurface(hl->display, config, (i32[]) {
+            EGL_WIDTH,  hl->width,
+            EGL_HEIGHT, hl->height,
+            EGL_NONE
+        });
+    if (hl->surface == EGL_NO_SURFACE) {
+        printf("ERROR: eglCreatePbufferSurface\n");
+        return false;
+    }
+
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        printf("ERROR: eglBindAPI\n");
+        return false;
+    }
+    // 4.3 is needed for debug groups and is the highest version llvmpipe
+    // reliably provides.
+    hl->context = eglCreateContext(hl->display, config, EGL_NO_CONTEXT, (i32[]) {
+            EGL_CONTEXT_MAJOR_VERSION,       4,
+            EGL_CONTEXT_MINOR_VERSION,       3,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE
+        });
+    if (hl->context == EGL_NO_CONTEXT) {
+        printf("ERROR: eglCreateContext\n");
+        return false;
+    }
+
+    if (!eglMakeCurrent(hl->display, hl->surface, hl->surface, hl->context)) {
+        printf("ERROR: eglMakeCurrent\n");
+        return false;
+    }
+
+    if (!gladLoadGL((GLADloadfunc) eglGetProcAddress)) {
+        printf("ERROR: GLAD failed to load OpenGL functions.\n");
+        return false;
+    }
+
+    return true;
+}
+
+// Also releases a partially created context.
+static void context_destroy(hl_renderer_t* hl) {
+    if (hl->display == EGL_NO_DISPLAY) {
+        return;
+    }
+    eglMakeCurrent(hl->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (hl->context != EGL_NO_CONTEXT) {
+        eglDestroyContext(hl->display, hl->context);
+    }
+    if (hl->surface != EGL_NO_SURFACE) {
+        eglDestroySurface(hl->display, hl->surface);
+    }
+    eglTerminate(hl->display);
+}
+
+static void context_present(hl_renderer_t* hl) {
+    eglSwapBuffers(hl->display, hl->surface);
+}
+
+#endif // HEADLESS_OSMESA
+
+// Writes the default framebuffer as a binary PPM.
+static void write_frame(hl_renderer_t* hl, const char* filename) {
+    u32 row_size = hl->width * 4;
+    u8* pixels = malloc(row_size * hl->height);
+    // Through the render API so its cached binding stays in sync.
+    framebuffer_unbind();
+    glReadPixels(0, 0, hl->width, hl->height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+
+    FILE* fp = fopen(filename, "wb");
+    if (fp == NULL) {
+        printf("ERROR: Failed to open '%s' for writing.\n", filename);
+        free(pixels);
+        return;
+    }
+    fprintf(fp, "P6\n%u %u\n255\n", hl->width, hl->height);
+    // GL stores the bottom row first.
+    for (i32 y = hl->height - 1; y >= 0; y--) {
+        for (u32 x = 0; x < hl->width; x++) {
+            fwrite(&pixels[y*row_size + x*4], 1, 3, fp);
+        }
+    }
+    fclose(fp);
+    free(pixels);
+}
+
+renderer_t* renderer_new(u32 width, u32 height, const char *title) {
+    (void) title;
+
+    hl_renderer_t* hl = malloc(sizeof(hl_renderer_t));
+    *hl = (hl_renderer_t) {
+        .width = width,
+        .height = height,
+    };
+    // Nothing can be rendered without a context, so there's no renderer
+    // either. Machines without EGL or a software rasterizer end up here.
+    if (!context_create(hl)) {
+        printf("ERROR: Failed to create headless context.\n");
+        context_destroy(hl);
+        free(hl);
+        return NULL;
+    }
+    hl_start_time = monotonic_time();
+
+    renderer_t* rend = malloc(sizeof(renderer_t));
+    *rend = (renderer_t) {
+        .data = hl,
+    };
+    renderer_frames_init(rend);
+
+    return rend;
+}
+
+void renderer_free(renderer_t* renderer) {
+    hl_renderer_t* hl = renderer->data;
+    context_destroy(hl);
+    renderer_frames_free(renderer);
+
+    free(hl);
+    free(renderer);
+}
+
+void renderer_swap_buffers(renderer_t* renderer) {
+    hl_renderer_t* hl = renderer->data;
+    context_present(hl);
+    hl_frame_index++;
+}
+
+void renderer_run(renderer_t* renderer) {
+    hl_renderer_t* hl = renderer->data;
+    if (renderer->resize_cb != NULL) {
+        renderer->resize_cb(renderer, hl->width, hl->height);
+    }
+
+    u32 frame_count = HEADLESS_DEFAULT_FRAMES;
+    const char* frames_env = getenv("HEADLESS_FRAMES");
+    if (frames_env != NULL) {
+        frame_count = strtoul(frames_env, NULL, 10);
+    }
+
+    for (u32 i = 0; i < frame_count; i++) {
+        renderer_frame_begin(renderer);
+        if (renderer->update_cb != NULL) {
+            renderer->update_cb(renderer);
+        }
+    }
+
+    const char* output = getenv("HEADLESS_OUTPUT");
+    if (output != NULL) {
+        write_frame(hl, output);
+    }
+}
+
+f32 get_time(void) {
+#ifdef HEADLESS_FIXED_TIMESTEP
+    return (f64) hl_frame_index * (HEADLESS_FIXED_TIMESTEP);
+#else
+    return monotonic_time() - hl_start_time;
+#endif // HEADLESS_FIXED_TIMESTEP
+}
+
+#endif // HEADLESS
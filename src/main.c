@@ -1,4 +1,5 @@
 #include "core.h"
+#include "profiler.h"
 #include "program.h"
 
 #include <stdio.h>
@@ -10,8 +11,13 @@
 #endif // __EMSCRIPTEN__
 
 void update(renderer_t* rend) {
-    app_update(rend->user_ptr);
-    renderer_swap_buffers(rend);
+    PROFILE_FRAME();
+    PROFILE_SCOPE("app_update") {
+        app_update(rend->user_ptr, renderer_frame_arena(rend));
+    }
+    PROFILE_SCOPE("renderer_swap_buffers") {
+        renderer_swap_buffers(rend);
+    }
 }
 
 void resize_cb(renderer_t* renderer, i32 width, i32 height) {
@@ -20,6 +26,9 @@ void resize_cb(renderer_t* renderer, i32 width, i32 height) {
 
 i32 main(void) {
     renderer_t* rend = renderer_new(800, 600, "Cross-platform rendering");
+    if (rend == NULL) {
+        return 1;
+    }
     rend->resize_cb = resize_cb;
     rend->update_cb = update;
 
@@ -31,6 +40,10 @@ i32 main(void) {
 
     renderer_run(rend);
 
+#ifdef PROFILER_ENABLED
+    profiler_dump("trace.json", 120);
+#endif // PROFILER_ENABLED
+
     // Cleanup
     app_shutdown(app);
     renderer_free(rend);
@@ -0,0 +1,177 @@
+#include "profiler.h"
+#include "core.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Events per thread. Older events are overwritten.
+#define PROFILER_EVENT_CAPACITY (1 << 16)
+#define PROFILER_FRAME_CAPACITY 1024
+#define PROFILER_MAX_DEPTH 64
+
+typedef enum profiler_event_type_t {
+    PROFILER_EVENT_BEGIN,
+    PROFILER_EVENT_END,
+} profiler_event_type_t;
+
+typedef struct profiler_event_t profiler_event_t;
+struct profiler_event_t {
+    const char* name;
+    u64 time;
+    profiler_event_type_t type;
+};
+
+typedef struct profiler_thread_t profiler_thread_t;
+struct profiler_thread_t {
+    profiler_thread_t* next;
+    u32 id;
+    // Only written by the owning thread. Published with a release store so
+    // the dumping thread sees complete events.
+    u64 event_count;
+    profiler_event_t events[PROFILER_EVENT_CAPACITY];
+};
+
+// List of every thread that has recorded an event. Threads push themselves
+// onto it with a compare and swap.
+static profiler_thread_t* profiler_threads = NULL;
+static u32 profiler_next_thread_id = 0;
+
+static u64 profiler_frames[PROFILER_FRAME_CAPACITY];
+static u64 profiler_frame_count = 0;
+
+static thread_local profiler_thread_t* profiler_thread = NULL;
+
+static u64 profiler_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static profiler_thread_t* profiler_thread_get(void) {
+    if (profiler_thread != NULL) {
+        return profiler_thread;
+    }
+
+    profiler_thread_t* thread = calloc(1, sizeof(profiler_thread_t));
+    thread->id = __atomic_fetch_add(&profiler_next_thread_id, 1, __ATOMIC_RELAXED);
+    thread->next = __atomic_load_n(&profiler_threads, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&profiler_threads, &thread->next, thread,
+                true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    profiler_thread = thread;
+
+    return thread;
+}
+
+static void profiler_record(const char* name, profiler_event_type_t type) {
+    profiler_thread_t* thread = profiler_thread_get();
+    u64 count = thread->event_count;
+    thread->events[count % PROFILER_EVENT_CAPACITY] = (profiler_event_t) {
+        .name = name,
+        .time = profiler_now(),
+        .type = type,
+    };
+    __atomic_store_n(&thread->event_count, count + 1, __ATOMIC_RELEASE);
+}
+
+void profiler_begin(const char* name) {
+    profiler_record(name, PROFILER_EVENT_BEGIN);
+}
+
+void profiler_end(void) {
+    profiler_record(NULL, PROFILER_EVENT_END);
+}
+
+void profiler_frame_mark(void) {
+    profiler_frames[profiler_frame_count % PROFILER_FRAME_CAPACITY] = profiler_now();
+    profiler_frame_count++;
+}
+
+static void profiler_write_name(FILE* fp, const char* name) {
+    fputc('"', fp);
+    for (const char* c = name; *c != 0; c++) {
+        if (*c == '"' || *c == '\\') {
+            fputc('\\', fp);
+        }
+        fputc(*c, fp);
+    }
+    fputc('"', fp);
+}
+
+b8 profiler_dump(const char* filename, u32 frame_count) {
+    FILE* fp = fopen(filename, "wb");
+    if (fp == NULL) {
+        printf("ERROR: Failed to open '%s' for writing.\n", filename);
+        return false;
+    }
+
+    // Everything after the start of the oldest requested frame is written.
+    u64 stored_frames = min(profiler_frame_count, PROFILER_FRAME_CAPACITY);
+    frame_count = min(frame_count, stored_frames);
+    u64 window_start = 0;
+    if (frame_count != 0) {
+        window_start = profiler_frames[(profiler_frame_count - frame_count) % PROFILER_FRAME_CAPACITY];
+    }
+    u64 base = window_start;
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    b8 first = true;
+
+    for (u64 i = profiler_frame_count - frame_count; i < profiler_frame_count; i++) {
+        u64 time = profiler_frames[i % PROFILER_FRAME_CAPACITY];
+        fprintf(fp, "%s{\"name\":\"Frame\",\"ph\":\"i\",\"s\":\"g\",\"pid\":0,\"tid\":0,\"ts\":%.3f}",
+                first ? "" : ",\n",
+                (f64) (time - base) * 1e-3);
+        first = false;
+    }
+
+    profiler_thread_t* thread = __atomic_load_n(&profiler_threads, __ATOMIC_ACQUIRE);
+    for (; thread != NULL; thread = thread->next) {
+        u64 count = __atomic_load_n(&thread->event_count, __ATOMIC_ACQUIRE);
+        u64 start = count > PROFILER_EVENT_CAPACITY ? count - PROFILER_EVENT_CAPACITY : 0;
+
+        fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"Thread %u\"}}",
+                first ? "" : ",\n", thread->id, thread->id);
+        first = false;
+
+        // Pair up begin and end events into complete events. Ends whose begin
+        // got overwritten are skipped.
+        profiler_event_t stack[PROFILER_MAX_DEPTH];
+        u32 depth = 0;
+        for (u64 i = start; i < count; i++) {
+            profiler_event_t event = thread->events[i % PROFILER_EVENT_CAPACITY];
+            if (event.type == PROFILER_EVENT_BEGIN) {
+                if (depth < PROFILER_MAX_DEPTH) {
+                    stack[depth] = event;
+                }
+                depth++;
+                continue;
+            }
+
+            if (depth == 0) {
+                continue;
+            }
+            depth--;
+            if (depth >= PROFILER_MAX_DEPTH) {
+                continue;
+            }
+            profiler_event_t begin = stack[depth];
+            if (event.time < window_start) {
+                continue;
+            }
+            // Zones which started before the window are clamped to it.
+            u64 begin_time = max(begin.time, window_start);
+            fprintf(fp, ",\n{\"name\":");
+            profiler_write_name(fp, begin.name);
+            fprintf(fp, ",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                    thread->id,
+                    (f64) (begin_time - base) * 1e-3,
+                    (f64) (event.time - begin_time) * 1e-3);
+        }
+    }
+
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+
+    return true;
+}
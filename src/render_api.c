@@ -1,9 +1,13 @@
 #include "render_api.h"
 #include "core.h"
+#include "profiler.h"
 
+#include <errno.h>
 #include <stdio.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 
 #ifdef __EMSCRIPTEN__
 #include <glad/gles2.h>
@@ -85,69 +89,217 @@ color_t color_hsv(f32 hue, f32 saturation, f32 value) {
     return color;
 }
 
-// -- Vertex buffer ------------------------------------------------------------
+// -- State cache --------------------------------------------------------------
+// Shadow copy of the GL state touched by the render API. Calls which wouldn't
+// change anything are skipped and counted.
+// :state
+
+#define MAX_TEXTURE_UNITS 16
+// Marks a binding as unknown so the next bind is always issued.
+#define STATE_UNKNOWN 0xffffffff
+
+typedef struct gl_state_t gl_state_t;
+struct gl_state_t {
+    b8 initialized;
+
+    u32 program;
+    u32 vao;
+    u32 array_buffer;
+    // Part of the VAO state so it's forgotten whenever the VAO changes.
+    u32 element_buffer;
+    u32 framebuffer;
+
+    u32 active_unit;
+    u32 textures[MAX_TEXTURE_UNITS];
+
+    // Generic binding used to upload data.
+    u32 uniform_buffer;
+    struct {
+        u32 handle;
+        u32 offset;
+        u32 size;
+    } uniform_ranges[UNIFORM_BINDING_MAX];
+
+    b8 blend_known;
+    b8 blend_enabled;
+    b8 blend_func_known;
+    blend_state_t blend_func;
+
+    b8 viewport_known;
+    i32 viewport[4];
+
+    b8 clear_color_known;
+    color_t clear_color;
+};
+
+static gl_state_t gl_state = {0};
+static render_stats_t render_stats = {0};
+
+static gl_state_t* state(void) {
+    if (!gl_state.initialized) {
+        render_state_invalidate();
+    }
+    return &gl_state;
+}
 
-vertex_buffer_t vertex_buffer_create(const void* data, u32 size, buffer_usage_t usage) {
-    GLint gl_usage;
+// Returns 'changed' and records whether the call was issued or skipped.
+static b8 state_changed(b8 changed) {
+    if (changed) {
+        render_stats.state_changes++;
+    } else {
+        render_stats.state_changes_skipped++;
+    }
+    return changed;
+}
+
+static void state_bind_texture(u32 slot, u32 handle) {
+    gl_state_t* st = state();
+    if (!state_changed(st->textures[slot] != handle)) {
+        return;
+    }
+    if (st->active_unit != slot) {
+        glActiveTexture(GL_TEXTURE0 + slot);
+        st->active_unit = slot;
+    }
+    glBindTexture(GL_TEXTURE_2D, handle);
+    st->textures[slot] = handle;
+}
+
+static void state_bind_vao(u32 handle) {
+    gl_state_t* st = state();
+    if (state_changed(st->vao != handle)) {
+        glBindVertexArray(handle);
+        st->vao = handle;
+        st->element_buffer = STATE_UNKNOWN;
+    }
+}
+
+void render_state_invalidate(void) {
+    gl_state = (gl_state_t) {
+        .initialized = true,
+        .program = STATE_UNKNOWN,
+        .vao = STATE_UNKNOWN,
+        .array_buffer = STATE_UNKNOWN,
+        .element_buffer = STATE_UNKNOWN,
+        .framebuffer = STATE_UNKNOWN,
+        .active_unit = STATE_UNKNOWN,
+        .uniform_buffer = STATE_UNKNOWN,
+    };
+    for (u32 i = 0; i < MAX_TEXTURE_UNITS; i++) {
+        gl_state.textures[i] = STATE_UNKNOWN;
+    }
+    for (u32 i = 0; i < UNIFORM_BINDING_MAX; i++) {
+        gl_state.uniform_ranges[i].handle = STATE_UNKNOWN;
+    }
+}
+
+render_stats_t render_stats_get(void) {
+    return render_stats;
+}
+
+void render_stats_reset(void) {
+    render_stats = (render_stats_t) {0};
+}
+
+void viewport_set(i32 x, i32 y, i32 width, i32 height) {
+    gl_state_t* st = state();
+    b8 changed = !st->viewport_known ||
+        st->viewport[0] != x ||
+        st->viewport[1] != y ||
+        st->viewport[2] != width ||
+        st->viewport[3] != height;
+    if (state_changed(changed)) {
+        glViewport(x, y, width, height);
+        st->viewport_known = true;
+        st->viewport[0] = x;
+        st->viewport[1] = y;
+        st->viewport[2] = width;
+        st->viewport[3] = height;
+    }
+}
 
+static void state_clear_color(color_t color) {
+    gl_state_t* st = state();
+    b8 changed = !st->clear_color_known ||
+        memcmp(&st->clear_color, &color, sizeof(color_t)) != 0;
+    if (state_changed(changed)) {
+        glClearColor(color_arg(color));
+        st->clear_color_known = true;
+        st->clear_color = color;
+    }
+}
+
+// -- Vertex buffer ------------------------------------------------------------
+
+static GLenum buffer_usage_to_gl(buffer_usage_t usage) {
     switch (usage) {
         case BUFFER_USAGE_STATIC:
-            gl_usage = GL_STATIC_DRAW;
-            break;
+            return GL_STATIC_DRAW;
         case BUFFER_USAGE_DYNAMIC:
-            gl_usage = GL_DYNAMIC_DRAW;
-            break;
+            return GL_DYNAMIC_DRAW;
         case BUFFER_USAGE_STREAM:
-            gl_usage = GL_STREAM_DRAW;
-            break;
+            return GL_STREAM_DRAW;
     }
 
+    return GL_INVALID_ENUM;
+}
+
+vertex_buffer_t vertex_buffer_create(const void* data, u32 size, buffer_usage_t usage) {
     vertex_buffer_t buff = {
         .size = size,
+        .usage = usage,
     };
     glGenBuffers(1, &buff.handle);
     vertex_buffer_bind(buff);
-    glBufferData(GL_ARRAY_BUFFER, size, data, gl_usage);
+    glBufferData(GL_ARRAY_BUFFER, size, data, buffer_usage_to_gl(usage));
     vertex_buffer_unbind();
 
     return buff;
 }
 
+void vertex_buffer_set_data(vertex_buffer_t* buffer, const void* data, u32 size) {
+    vertex_buffer_bind(*buffer);
+    // Respecifying the whole store lets the driver hand out fresh memory
+    // instead of waiting for draws still reading the old contents.
+    glBufferData(GL_ARRAY_BUFFER, size, data, buffer_usage_to_gl(buffer->usage));
+    buffer->size = size;
+}
+
+void vertex_buffer_sub_data(vertex_buffer_t buffer, u32 offset, const void* data, u32 size) {
+    vertex_buffer_bind(buffer);
+    glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+}
+
 void vertex_buffer_destroy(vertex_buffer_t buffer) {
     glDeleteBuffers(1, &buffer.handle);
+    // Deleting a bound buffer reverts the binding to 0.
+    gl_state_t* st = state();
+    if (st->array_buffer == buffer.handle) {
+        st->array_buffer = 0;
+    }
 }
 
 void vertex_buffer_bind(vertex_buffer_t buffer) {
-    glBindBuffer(GL_ARRAY_BUFFER, buffer.handle);
+    gl_state_t* st = state();
+    if (state_changed(st->array_buffer != buffer.handle)) {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer.handle);
+        st->array_buffer = buffer.handle;
+    }
 }
 
 void vertex_buffer_unbind(void) {
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    vertex_buffer_bind((vertex_buffer_t) {0});
 }
 
 // -- Index buffer -------------------------------------------------------------
 
 index_buffer_t index_buffer_create(const u32* data, u32 count, buffer_usage_t usage) {
-    GLint gl_usage;
-
-    switch (usage) {
-        case BUFFER_USAGE_STATIC:
-            gl_usage = GL_STATIC_DRAW;
-            break;
-        case BUFFER_USAGE_DYNAMIC:
-            gl_usage = GL_DYNAMIC_DRAW;
-            break;
-        case BUFFER_USAGE_STREAM:
-            gl_usage = GL_STREAM_DRAW;
-            break;
-    }
-
     index_buffer_t buff = {
         .count = count,
     };
     glGenBuffers(1, &buff.handle);
     index_buffer_bind(buff);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, count * sizeof(u32), data, gl_usage);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, count * sizeof(u32), data, buffer_usage_to_gl(usage));
     index_buffer_unbind();
 
     return buff;
@@ -155,85 +307,917 @@ index_buffer_t index_buffer_create(const u32* data, u32 count, buffer_usage_t us
 
 void index_buffer_destroy(index_buffer_t buffer) {
     glDeleteBuffers(1, &buffer.handle);
+    // The buffer might still be referenced by a VAO that isn't bound.
+    state()->element_buffer = STATE_UNKNOWN;
 }
 
 void index_buffer_bind(index_buffer_t buffer) {
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer.handle);
+    gl_state_t* st = state();
+    if (state_changed(st->element_buffer != buffer.handle)) {
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer.handle);
+        st->element_buffer = buffer.handle;
+    }
 }
 
 void index_buffer_unbind(void) {
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    index_buffer_bind((index_buffer_t) {0});
+}
+
+// -- Uniform buffer -----------------------------------------------------------
+
+static void uniform_buffer_bind(u32 handle) {
+    gl_state_t* st = state();
+    if (state_changed(st->uniform_buffer != handle)) {
+        glBindBuffer(GL_UNIFORM_BUFFER, handle);
+        st->uniform_buffer = handle;
+    }
+}
+
+uniform_buffer_t uniform_buffer_create(const void* data, u32 size, buffer_usage_t usage) {
+    uniform_buffer_t buff = {
+        .usage = usage,
+    };
+    glGenBuffers(1, &buff.handle);
+    uniform_buffer_set_data(&buff, data, size);
+
+    return buff;
+}
+
+void uniform_buffer_set_data(uniform_buffer_t* buffer, const void* data, u32 size) {
+    uniform_buffer_bind(buffer->handle);
+    glBufferData(GL_UNIFORM_BUFFER, size, data, buffer_usage_to_gl(buffer->usage));
+    buffer->size = size;
+    if (data != NULL) {
+        render_stats.uniform_updates++;
+    }
+
+    // Ranges bound from the old store are stale.
+    gl_state_t* st = state();
+    for (u32 i = 0; i < UNIFORM_BINDING_MAX; i++) {
+        if (st->uniform_ranges[i].handle == buffer->handle) {
+            st->uniform_ranges[i].handle = STATE_UNKNOWN;
+        }
+    }
+}
+
+void uniform_buffer_sub_data(uniform_buffer_t buffer, u32 offset, const void* data, u32 size) {
+    uniform_buffer_bind(buffer.handle);
+    glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data);
+    render_stats.uniform_updates++;
+}
+
+void uniform_buffer_destroy(uniform_buffer_t buffer) {
+    glDeleteBuffers(1, &buffer.handle);
+    // Deleting a buffer reverts every binding of it to 0.
+    gl_state_t* st = state();
+    if (st->uniform_buffer == buffer.handle) {
+        st->uniform_buffer = 0;
+    }
+    for (u32 i = 0; i < UNIFORM_BINDING_MAX; i++) {
+        if (st->uniform_ranges[i].handle == buffer.handle) {
+            st->uniform_ranges[i].handle = 0;
+        }
+    }
+}
+
+void uniform_buffer_bind_range(uniform_buffer_t buffer, u32 binding, u32 offset, u32 size) {
+    if (binding >= UNIFORM_BINDING_MAX) {
+        printf("ERROR: Uniform binding %u is out of range, at most %u are supported.\n", binding, UNIFORM_BINDING_MAX);
+        return;
+    }
+
+    gl_state_t* st = state();
+    b8 changed = st->uniform_ranges[binding].handle != buffer.handle ||
+        st->uniform_ranges[binding].offset != offset ||
+        st->uniform_ranges[binding].size != size;
+    if (state_changed(changed)) {
+        glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer.handle, offset, size);
+        st->uniform_ranges[binding].handle = buffer.handle;
+        st->uniform_ranges[binding].offset = offset;
+        st->uniform_ranges[binding].size = size;
+        // Binding a range also sets the generic binding.
+        st->uniform_buffer = buffer.handle;
+    }
+}
+
+u32 uniform_buffer_offset_alignment(void) {
+    static u32 alignment = 0;
+    if (alignment == 0) {
+        i32 value = 0;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &value);
+        alignment = value > 0 ? value : 256;
+    }
+    return alignment;
+}
+
+// -- Uniform ring -------------------------------------------------------------
+
+uniform_ring_t uniform_ring_create(u32 capacity) {
+    uniform_ring_t ring = {
+        .staging = malloc(capacity),
+        .capacity = capacity,
+        .alignment = uniform_buffer_offset_alignment(),
+    };
+    for (u32 i = 0; i < UNIFORM_RING_SIZE; i++) {
+        ring.buffers[i] = uniform_buffer_create(NULL, capacity, BUFFER_USAGE_STREAM);
+    }
+    return ring;
+}
+
+void uniform_ring_destroy(uniform_ring_t* ring) {
+    for (u32 i = 0; i < UNIFORM_RING_SIZE; i++) {
+        uniform_buffer_destroy(ring->buffers[i]);
+    }
+    free(ring->staging);
+    *ring = (uniform_ring_t) {0};
+}
+
+void uniform_ring_frame_begin(uniform_ring_t* ring) {
+    ring->index = (ring->index + 1) % UNIFORM_RING_SIZE;
+    ring->offset = 0;
+    ring->uploaded = 0;
+
+    // Catch up with growth during an earlier frame.
+    uniform_buffer_t* buffer = &ring->buffers[ring->index];
+    if (buffer->size != ring->capacity) {
+        uniform_buffer_set_data(buffer, NULL, ring->capacity);
+    }
+}
+
+uniform_range_t uniform_ring_push(uniform_ring_t* ring, const void* data, u32 size) {
+    u32 offset = (ring->offset + ring->alignment - 1) / ring->alignment * ring->alignment;
+    if (offset + size > ring->capacity) {
+        while (offset + size > ring->capacity) {
+            ring->capacity *= 2;
+        }
+        ring->staging = realloc(ring->staging, ring->capacity);
+        // Draws already issued keep reading the old store. Everything pushed
+        // so far is uploaded again into the new one.
+        uniform_buffer_set_data(&ring->buffers[ring->index], NULL, ring->capacity);
+        ring->uploaded = 0;
+    }
+
+    memcpy(ring->staging + offset, data, size);
+    ring->offset = offset + size;
+    return (uniform_range_t) {
+        .offset = offset,
+        .size = size,
+    };
+}
+
+void uniform_ring_bind(uniform_ring_t* ring, uniform_range_t range, u32 binding) {
+    uniform_buffer_t buffer = ring->buffers[ring->index];
+    if (ring->uploaded < ring->offset) {
+        uniform_buffer_sub_data(buffer, ring->uploaded, ring->staging + ring->uploaded, ring->offset - ring->uploaded);
+        ring->uploaded = ring->offset;
+    }
+    uniform_buffer_bind_range(buffer, binding, range.offset, range.size);
 }
 
 // -- Shader -------------------------------------------------------------------
 
-shader_t shader_create(str_t vertex_source, str_t fragment_source) {
-    i32 success = 0;
-    char info_log[512] = {0};
-
-    u32 v_shader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(v_shader, 1, (const char* const*) &vertex_source.data, (const int*) &vertex_source.len);
-    glCompileShader(v_shader);
-    glGetShaderiv(v_shader, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        glGetShaderInfoLog(v_shader, sizeof(info_log), NULL, info_log);
-        printf("Vertex shader compilation error: %s\n", info_log);
+typedef struct shader_uniform_entry_t shader_uniform_entry_t;
+struct shader_uniform_entry_t {
+    const char* name;
+    u32 hash;
+    i32 location;
+    // GL type and array size of the uniform.
+    u32 type;
+    i32 size;
+};
+
+struct shader_info_t {
+    shader_status_t status;
+    // Open addressing hash table keyed on the hash of the uniform name. The
+    // capacity is a power of two and at least twice the uniform count so a
+    // lookup always finds an empty slot. NULL until the program is linked.
+    shader_uniform_entry_t* uniforms;
+    u32 uniform_capacity;
+    u32 uniform_count;
+
+    // The attached stages and the binary cache key, 0 if the binary isn't
+    // stored. The key is only used while pending.
+    u32 vertex;
+    u32 fragment;
+    u64 binary_key;
+    // Set if the program holds a reference on both stages in the stage cache,
+    // which is dropped when the program is destroyed.
+    b8 stage_refs;
+};
+
+static shader_info_t* shader_info_new(shader_status_t status) {
+    shader_info_t* info = malloc(sizeof(shader_info_t));
+    *info = (shader_info_t) {
+        .status = status,
+    };
+    return info;
+}
+
+// Enumerate all active uniforms and samplers of a linked program. The entries
+// and their names share one allocation.
+static void shader_reflect(shader_info_t* info, u32 program) {
+    i32 active_count = 0;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &active_count);
+    i32 max_name_len = 0;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_name_len);
+
+    u32 capacity = 8;
+    while (capacity < (u32) active_count * 2) {
+        capacity *= 2;
+    }
+
+    u32 size = capacity * sizeof(shader_uniform_entry_t) + active_count * max_name_len;
+    info->uniforms = malloc(size);
+    memset(info->uniforms, 0, size);
+    info->uniform_capacity = capacity;
+    info->uniform_count = 0;
+
+    char* name = (char*) (info->uniforms + capacity);
+    for (i32 i = 0; i < active_count; i++) {
+        GLsizei name_len = 0;
+        GLint uniform_size = 0;
+        GLenum type = 0;
+        glGetActiveUniform(program, i, max_name_len, &name_len, &uniform_size, &type, name);
+
+        // Arrays are reported as 'name[0]'. Strip the subscript so they can be
+        // looked up by the name used in the source.
+        if (name_len > 3 && strcmp(name + name_len - 3, "[0]") == 0) {
+            name_len -= 3;
+            name[name_len] = 0;
+        }
+
+        // Members of uniform blocks don't have a location.
+        i32 location = glGetUniformLocation(program, name);
+        if (location == -1) {
+            continue;
+        }
+
+        u32 hash = str_hash(str((const u8*) name, name_len));
+        u32 mask = capacity - 1;
+        u32 slot = hash & mask;
+        while (info->uniforms[slot].name != NULL) {
+            slot = (slot + 1) & mask;
+        }
+        info->uniforms[slot] = (shader_uniform_entry_t) {
+            .name = name,
+            .hash = hash,
+            .location = location,
+            .type = type,
+            .size = uniform_size,
+        };
+        info->uniform_count++;
+
+        name += name_len + 1;
+    }
+}
+
+// Prints the whole info log of a shader or program. Logs are read into
+// scratch memory since they easily outgrow a fixed buffer.
+static void info_log_print(const char* message, u32 handle, b8 is_program) {
+    i32 len = 0;
+    if (is_program) {
+        glGetProgramiv(handle, GL_INFO_LOG_LENGTH, &len);
+    } else {
+        glGetShaderiv(handle, GL_INFO_LOG_LENGTH, &len);
+    }
+
+    arena_temp_t scratch = arena_scratch(NULL, 0);
+    char* info_log = arena_push(scratch.arena, len + 1);
+    info_log[0] = 0;
+    if (is_program) {
+        glGetProgramInfoLog(handle, len + 1, NULL, info_log);
+    } else {
+        glGetShaderInfoLog(handle, len + 1, NULL, info_log);
+    }
+    printf("%s: %s\n", message, info_log);
+    arena_scratch_release(scratch);
+}
+
+// -- Shader stage cache -------------------------------------------------------
+
+typedef struct shader_stage_entry_t shader_stage_entry_t;
+struct shader_stage_entry_t {
+    u64 hash;
+    u32 len;
+    shader_stage_type_t type;
+    // 0 marks an empty slot.
+    u32 handle;
+    // Pending until the compile status is first queried.
+    shader_status_t status;
+    // Programs created from the stage. The stage is deleted when the last one
+    // is destroyed, unless it was handed out by 'shader_stage_compile'.
+    u32 refs;
+    b8 pinned;
+};
+
+// Open addressing hash table with linear probing, kept at most half full.
+typedef struct shader_stage_cache_t shader_stage_cache_t;
+struct shader_stage_cache_t {
+    shader_stage_entry_t* entries;
+    u32 capacity;
+    u32 count;
+    u32 hits;
+    u32 misses;
+};
+
+static shader_stage_cache_t stage_cache = {0};
+
+static u32 stage_cache_home(u32 capacity, shader_stage_type_t type, u64 hash) {
+    return (hash ^ (hash >> 32) ^ type) & (capacity - 1);
+}
+
+static shader_stage_entry_t* stage_cache_slot(shader_stage_entry_t* entries, u32 capacity, shader_stage_type_t type, u64 hash, u32 len) {
+    u32 mask = capacity - 1;
+    u32 slot = stage_cache_home(capacity, type, hash);
+    while (entries[slot].handle != 0) {
+        const shader_stage_entry_t* entry = &entries[slot];
+        if (entry->hash == hash && entry->len == len && entry->type == type) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return &entries[slot];
+}
+
+static void stage_cache_grow(void) {
+    u32 capacity = stage_cache.capacity == 0 ? 32 : stage_cache.capacity * 2;
+    shader_stage_entry_t* entries = calloc(capacity, sizeof(shader_stage_entry_t));
+    for (u32 i = 0; i < stage_cache.capacity; i++) {
+        const shader_stage_entry_t* entry = &stage_cache.entries[i];
+        if (entry->handle != 0) {
+            *stage_cache_slot(entries, capacity, entry->type, entry->hash, entry->len) = *entry;
+        }
+    }
+    free(stage_cache.entries);
+    stage_cache.entries = entries;
+    stage_cache.capacity = capacity;
+}
+
+// Starts compiling a stage without waiting for the result, unless it's
+// cached already. The entry is only valid until the next submit or release.
+static shader_stage_entry_t* stage_submit(shader_stage_type_t type, str_t source) {
+    if ((stage_cache.count + 1) * 2 > stage_cache.capacity) {
+        stage_cache_grow();
+    }
+
+    u64 hash = str_hash64(source);
+    shader_stage_entry_t* entry = stage_cache_slot(stage_cache.entries, stage_cache.capacity, type, hash, source.len);
+    if (entry->handle != 0) {
+        stage_cache.hits++;
+        return entry;
+    }
+
+    PROFILE_BEGIN("stage_submit");
+    stage_cache.misses++;
+    u32 handle = glCreateShader(type == SHADER_STAGE_VERTEX ? GL_VERTEX_SHADER : GL_FRAGMENT_SHADER);
+    glShaderSource(handle, 1, (const char* const*) &source.data, (const int*) &source.len);
+    glCompileShader(handle);
+    *entry = (shader_stage_entry_t) {
+        .hash = hash,
+        .len = source.len,
+        .type = type,
+        .handle = handle,
+        .status = SHADER_STATUS_PENDING,
+    };
+    stage_cache.count++;
+    PROFILE_END();
+    return entry;
+}
+
+// Waits for the stage to compile. A failed stage stays cached, so its errors
+// are printed for every program that uses it, not just the first one. The
+// info log is kept by the shader object.
+static b8 stage_resolve(shader_stage_entry_t* entry) {
+    if (entry->status == SHADER_STATUS_PENDING) {
+        i32 success = 0;
+        glGetShaderiv(entry->handle, GL_COMPILE_STATUS, &success);
+        entry->status = success ? SHADER_STATUS_READY : SHADER_STATUS_FAILED;
+    }
+    if (entry->status == SHADER_STATUS_FAILED) {
+        info_log_print(entry->type == SHADER_STAGE_VERTEX ?
+                "Vertex shader compilation error" :
+                "Fragment shader compilation error", entry->handle, false);
+    }
+    return entry->status == SHADER_STATUS_READY;
+}
+
+static shader_stage_entry_t* stage_cache_find(u32 handle) {
+    for (u32 i = 0; i < stage_cache.capacity; i++) {
+        if (stage_cache.entries[i].handle == handle) {
+            return &stage_cache.entries[i];
+        }
+    }
+    return NULL;
+}
+
+// Empties the slot and shifts the following entries of the probe sequence
+// back, so lookups never stop early at the hole.
+static void stage_cache_remove(shader_stage_entry_t* entry) {
+    u32 mask = stage_cache.capacity - 1;
+    u32 hole = (u32) (entry - stage_cache.entries);
+    for (u32 slot = (hole + 1) & mask; stage_cache.entries[slot].handle != 0; slot = (slot + 1) & mask) {
+        const shader_stage_entry_t* next = &stage_cache.entries[slot];
+        u32 home = stage_cache_home(stage_cache.capacity, next->type, next->hash);
+        // Only entries whose home slot isn't between the hole and their
+        // current slot can move into the hole.
+        if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+            stage_cache.entries[hole] = *next;
+            hole = slot;
+        }
+    }
+    stage_cache.entries[hole] = (shader_stage_entry_t) {0};
+    stage_cache.count--;
+}
+
+// Drops a program's reference and deletes the stage once it's unused, so
+// stages replaced by a hot reload don't pile up.
+static void stage_release(u32 handle) {
+    shader_stage_entry_t* entry = stage_cache_find(handle);
+    if (entry == NULL || --entry->refs > 0 || entry->pinned) {
+        return;
+    }
+    glDeleteShader(entry->handle);
+    stage_cache_remove(entry);
+}
+
+shader_stage_t shader_stage_compile(shader_stage_type_t type, str_t source) {
+    shader_stage_entry_t* entry = stage_submit(type, source);
+    // The caller may link the stage any number of times, so it's kept until
+    // the cache is cleared.
+    entry->pinned = true;
+    if (!stage_resolve(entry)) {
+        return (shader_stage_t) {0};
+    }
+    return (shader_stage_t) {entry->handle};
+}
+
+void shader_stage_cache_clear(void) {
+    for (u32 i = 0; i < stage_cache.capacity; i++) {
+        if (stage_cache.entries[i].handle != 0) {
+            glDeleteShader(stage_cache.entries[i].handle);
+        }
+    }
+    free(stage_cache.entries);
+    stage_cache = (shader_stage_cache_t) {0};
+}
+
+shader_stage_cache_stats_t shader_stage_cache_stats(void) {
+    return (shader_stage_cache_stats_t) {
+        .stage_count = stage_cache.count,
+        .hits = stage_cache.hits,
+        .misses = stage_cache.misses,
+    };
+}
+
+// -- Program binary cache -----------------------------------------------------
+// One file per program: a header followed by the binary returned by the
+// driver. Files are written under a temporary name and renamed, so a reader
+// never sees a partial file.
+
+#define SHADER_BINARY_MAGIC 0x4e494250 // 'PBIN'
+
+typedef struct shader_binary_header_t shader_binary_header_t;
+struct shader_binary_header_t {
+    u32 magic;
+    u32 format;
+    u64 key;
+    u32 size;
+    u32 reserved;
+};
+
+typedef struct shader_binary_cache_t shader_binary_cache_t;
+struct shader_binary_cache_t {
+    b8 enabled;
+    char dir[512];
+    // Binaries are only valid for the driver which produced them.
+    u64 driver_hash;
+    u32 hits;
+    u32 misses;
+    u32 rejected;
+};
+
+static shader_binary_cache_t binary_cache = {0};
+
+void shader_binary_cache_init(const char* dir) {
+    binary_cache = (shader_binary_cache_t) {0};
+
+    i32 format_count = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &format_count);
+    if (format_count == 0) {
+        return;
+    }
+    if (strlen(dir) >= sizeof(binary_cache.dir)) {
+        printf("ERROR: Shader cache path '%s' is too long.\n", dir);
+        return;
+    }
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        printf("ERROR: Failed to create shader cache directory '%s'.\n", dir);
+        return;
+    }
+
+    arena_temp_t scratch = arena_scratch(NULL, 0);
+    u32 len = 0;
+    const char* strings[] = {
+        (const char*) glGetString(GL_VENDOR),
+        (const char*) glGetString(GL_RENDERER),
+        (const char*) glGetString(GL_VERSION),
+    };
+    for (u32 i = 0; i < arr_len(strings); i++) {
+        len += strlen(strings[i]) + 1;
+    }
+    char* driver = arena_push(scratch.arena, len + 1);
+    snprintf(driver, len + 1, "%s\n%s\n%s\n", strings[0], strings[1], strings[2]);
+    binary_cache.driver_hash = str_hash64(str((const u8*) driver, len));
+    arena_scratch_release(scratch);
+
+    strcpy(binary_cache.dir, dir);
+    binary_cache.enabled = true;
+}
+
+shader_binary_cache_stats_t shader_binary_cache_stats(void) {
+    return (shader_binary_cache_stats_t) {
+        .enabled = binary_cache.enabled,
+        .hits = binary_cache.hits,
+        .misses = binary_cache.misses,
+        .rejected = binary_cache.rejected,
+    };
+}
+
+static u64 shader_binary_key(str_t vertex_source, str_t fragment_source) {
+    u64 parts[] = {
+        str_hash64(vertex_source),
+        str_hash64(fragment_source),
+        binary_cache.driver_hash,
+    };
+    return str_hash64(str((const u8*) parts, sizeof(parts)));
+}
+
+static void shader_binary_path(char* path, u32 size, u64 key) {
+    snprintf(path, size, "%s/%016llx.bin", binary_cache.dir, (unsigned long long) key);
+}
+
+// Returns a shader with handle 0 if there's no usable binary.
+static shader_t shader_binary_load(u64 key) {
+    char path[600];
+    shader_binary_path(path, sizeof(path), key);
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) {
         return (shader_t) {0};
     }
 
-    u32 f_shader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(f_shader, 1, (const char* const*) &fragment_source.data, (const int*) &fragment_source.len);
-    glCompileShader(f_shader);
-    glGetShaderiv(f_shader, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        glGetShaderInfoLog(f_shader, sizeof(info_log), NULL, info_log);
-        printf("Fragment shader compilation error: %s\n", info_log);
+    PROFILE_BEGIN("shader_binary_load");
+    // The size in the header is checked against the file before anything is
+    // allocated for it. A truncated or corrupt file is rejected instead of
+    // overflowing the arena.
+    i64 file_size = -1;
+    if (fseek(fp, 0, SEEK_END) == 0) {
+        file_size = ftell(fp);
+        rewind(fp);
+    }
+
+    arena_temp_t scratch = arena_scratch(NULL, 0);
+    shader_binary_header_t header = {0};
+    u8* binary = NULL;
+    if (fread(&header, sizeof(header), 1, fp) == 1 &&
+            header.magic == SHADER_BINARY_MAGIC &&
+            header.key == key &&
+            (i64) header.size == file_size - (i64) sizeof(header)) {
+        binary = arena_push(scratch.arena, header.size);
+        if (fread(binary, 1, header.size, fp) != header.size) {
+            binary = NULL;
+        }
+    }
+    fclose(fp);
+
+    u32 program = 0;
+    if (binary != NULL) {
+        program = glCreateProgram();
+        glProgramBinary(program, header.format, binary, header.size);
+        i32 success = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if (!success) {
+            glDeleteProgram(program);
+            program = 0;
+        }
+    }
+    arena_scratch_release(scratch);
+    if (program == 0) {
+        // Typically a driver update. Recompiling overwrites the file.
+        binary_cache.rejected++;
+        PROFILE_END();
         return (shader_t) {0};
     }
 
+    shader_t shader = {
+        .handle = program,
+        .info = shader_info_new(SHADER_STATUS_READY),
+    };
+    shader_reflect(shader.info, program);
+    PROFILE_END();
+    return shader;
+}
+
+static void shader_binary_store(u64 key, u32 program) {
+    PROFILE_BEGIN("shader_binary_store");
+    i32 size = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+    if (size <= 0) {
+        PROFILE_END();
+        return;
+    }
+
+    arena_temp_t scratch = arena_scratch(NULL, 0);
+    u8* binary = arena_push(scratch.arena, size);
+    shader_binary_header_t header = {
+        .magic = SHADER_BINARY_MAGIC,
+        .key = key,
+    };
+    GLsizei written = 0;
+    GLenum format = 0;
+    glGetProgramBinary(program, size, &written, &format, binary);
+    header.format = format;
+    header.size = written;
+
+    char path[600];
+    char tmp_path[610];
+    shader_binary_path(path, sizeof(path), key);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE* fp = fopen(tmp_path, "wb");
+    if (fp == NULL) {
+        printf("ERROR: Failed to write shader cache file '%s'.\n", tmp_path);
+        arena_scratch_release(scratch);
+        PROFILE_END();
+        return;
+    }
+    b8 success = written > 0 &&
+        fwrite(&header, sizeof(header), 1, fp) == 1 &&
+        fwrite(binary, 1, written, fp) == (u64) written;
+    success = fclose(fp) == 0 && success;
+    if (!success || rename(tmp_path, path) != 0) {
+        printf("ERROR: Failed to write shader cache file '%s'.\n", path);
+        remove(tmp_path);
+    }
+    arena_scratch_release(scratch);
+    PROFILE_END();
+}
+
+// -- Shader compilation -------------------------------------------------------
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif // GL_COMPLETION_STATUS_KHR
+
+// KHR_parallel_shader_compile, or its ARB twin on desktop. Lets the status of
+// a link be polled without waiting for it.
+static b8 parallel_compile_supported(void) {
+    static i32 supported = -1;
+    if (supported == -1) {
+        supported = false;
+        i32 count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (i32 i = 0; i < count; i++) {
+            const char* name = (const char*) glGetStringi(GL_EXTENSIONS, i);
+            if (strcmp(name, "GL_KHR_parallel_shader_compile") == 0 ||
+                    strcmp(name, "GL_ARB_parallel_shader_compile") == 0) {
+                supported = true;
+                break;
+            }
+        }
+    }
+    return supported;
+}
+
+// Starts linking without waiting for the stages or the link to finish.
+static shader_t shader_link_submit(u32 vertex, u32 fragment, u64 binary_key) {
+    PROFILE_BEGIN("shader_link_submit");
     u32 program = glCreateProgram();
-    glAttachShader(program, v_shader);
-    glAttachShader(program, f_shader);
+    if (binary_key != 0) {
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    glAttachShader(program, vertex);
+    glAttachShader(program, fragment);
     glLinkProgram(program);
-    glGetProgramiv(program, GL_LINK_STATUS, &success);
-    if (!success) {
-        glGetProgramInfoLog(program, 512, NULL, info_log);
-        printf("Shader linking error: %s\n", info_log);
+
+    shader_info_t* info = shader_info_new(SHADER_STATUS_PENDING);
+    info->vertex = vertex;
+    info->fragment = fragment;
+    info->binary_key = binary_key;
+    PROFILE_END();
+    return (shader_t) {
+        .handle = program,
+        .info = info,
+    };
+}
+
+// Waits for a pending link, then gathers the uniforms or prints the errors.
+static void shader_resolve(shader_t shader) {
+    shader_info_t* info = shader.info;
+    if (info == NULL || info->status != SHADER_STATUS_PENDING) {
+        return;
+    }
+
+    PROFILE_BEGIN("shader_resolve");
+    i32 success = 0;
+    glGetProgramiv(shader.handle, GL_LINK_STATUS, &success);
+    // Detached so deleting a cached stage frees it right away.
+    glDetachShader(shader.handle, info->vertex);
+    glDetachShader(shader.handle, info->fragment);
+
+    if (success) {
+        shader_reflect(info, shader.handle);
+        info->status = SHADER_STATUS_READY;
+        if (info->binary_key != 0) {
+            shader_binary_store(info->binary_key, shader.handle);
+        }
+    } else {
+        // A failed compile explains the failed link, so the link log is only
+        // printed if both stages compiled.
+        b8 compiled = true;
+        u32 stages[] = {info->vertex, info->fragment};
+        for (u32 i = 0; i < arr_len(stages); i++) {
+            shader_stage_entry_t* entry = stage_cache_find(stages[i]);
+            if (entry != NULL && !stage_resolve(entry)) {
+                compiled = false;
+            }
+        }
+        if (compiled) {
+            info_log_print("Shader linking error", shader.handle, true);
+        }
+        info->status = SHADER_STATUS_FAILED;
+    }
+    PROFILE_END();
+}
+
+shader_t shader_link(shader_stage_t vertex, shader_stage_t fragment) {
+    if (vertex.handle == 0 || fragment.handle == 0) {
         return (shader_t) {0};
     }
 
-    glDeleteShader(v_shader);
-    glDeleteShader(f_shader);
+    shader_t shader = shader_link_submit(vertex.handle, fragment.handle, 0);
+    shader_resolve(shader);
+    if (shader.info->status == SHADER_STATUS_FAILED) {
+        shader_destroy(shader);
+        return (shader_t) {0};
+    }
+    return shader;
+}
+
+shader_t shader_create_async(str_t vertex_source, str_t fragment_source) {
+    PROFILE_BEGIN("shader_create_async");
+    u64 key = 0;
+    if (binary_cache.enabled) {
+        key = shader_binary_key(vertex_source, fragment_source);
+        shader_t shader = shader_binary_load(key);
+        if (shader.handle != 0) {
+            binary_cache.hits++;
+            PROFILE_END();
+            return shader;
+        }
+        binary_cache.misses++;
+    }
 
-    return (shader_t) { program };
+    shader_stage_entry_t* entry = stage_submit(SHADER_STAGE_VERTEX, vertex_source);
+    entry->refs++;
+    u32 vertex = entry->handle;
+    entry = stage_submit(SHADER_STAGE_FRAGMENT, fragment_source);
+    entry->refs++;
+    u32 fragment = entry->handle;
+    shader_t shader = shader_link_submit(vertex, fragment, key);
+    shader.info->stage_refs = true;
+    PROFILE_END();
+    return shader;
+}
+
+shader_t shader_create(str_t vertex_source, str_t fragment_source) {
+    PROFILE_BEGIN("shader_create");
+    shader_t shader = shader_create_async(vertex_source, fragment_source);
+    shader_resolve(shader);
+    if (shader.info->status == SHADER_STATUS_FAILED) {
+        shader_destroy(shader);
+        shader = (shader_t) {0};
+    }
+    PROFILE_END();
+    return shader;
+}
+
+shader_status_t shader_poll(shader_t shader) {
+    if (shader.info == NULL) {
+        return SHADER_STATUS_FAILED;
+    }
+    if (shader.info->status == SHADER_STATUS_PENDING && parallel_compile_supported()) {
+        i32 done = 0;
+        glGetProgramiv(shader.handle, GL_COMPLETION_STATUS_KHR, &done);
+        if (!done) {
+            return SHADER_STATUS_PENDING;
+        }
+    }
+    shader_resolve(shader);
+    return shader.info->status;
 }
 
 void shader_destroy(shader_t shader) {
     glDeleteProgram(shader.handle);
+    if (shader.info != NULL) {
+        if (shader.info->stage_refs) {
+            stage_release(shader.info->vertex);
+            stage_release(shader.info->fragment);
+        }
+        free(shader.info->uniforms);
+    }
+    free(shader.info);
+    gl_state_t* st = state();
+    if (st->program == shader.handle) {
+        st->program = STATE_UNKNOWN;
+    }
 }
 
 void shader_use(shader_t shader) {
-    glUseProgram(shader.handle);
+    // The first use of a pending shader waits for it.
+    shader_resolve(shader);
+    u32 handle = shader.handle;
+    if (shader.info != NULL && shader.info->status == SHADER_STATUS_FAILED) {
+        handle = 0;
+    }
+
+    gl_state_t* st = state();
+    if (state_changed(st->program != handle)) {
+        glUseProgram(handle);
+        st->program = handle;
+    }
+}
+
+uniform_t shader_uniform(shader_t shader, const char* name) {
+    shader_resolve(shader);
+    const shader_info_t* info = shader.info;
+    if (info == NULL || info->uniforms == NULL) {
+        return (uniform_t) { -1 };
+    }
+
+    u32 hash = str_hash(str_cstr(name));
+    u32 mask = info->uniform_capacity - 1;
+    for (u32 slot = hash & mask;; slot = (slot + 1) & mask) {
+        const shader_uniform_entry_t* entry = &info->uniforms[slot];
+        if (entry->name == NULL) {
+            return (uniform_t) { -1 };
+        }
+        if (entry->hash == hash && strcmp(entry->name, name) == 0) {
+            return (uniform_t) { entry->location };
+        }
+    }
+}
+
+void shader_uniform_block(shader_t shader, const char* name, u32 binding, u32 size) {
+    shader_resolve(shader);
+    if (shader.info == NULL || shader.info->status != SHADER_STATUS_READY) {
+        return;
+    }
+
+    u32 index = glGetUniformBlockIndex(shader.handle, name);
+    if (index == GL_INVALID_INDEX) {
+        return;
+    }
+    i32 block_size = 0;
+    glGetActiveUniformBlockiv(shader.handle, index, GL_UNIFORM_BLOCK_DATA_SIZE, &block_size);
+    if ((u32) block_size > size) {
+        printf("ERROR: Uniform block '%s' is %d bytes but its struct only %u.\n", name, block_size, size);
+    }
+    glUniformBlockBinding(shader.handle, index, binding);
+}
+
+void uniform_set_vec4(uniform_t uniform, Vec4 value) {
+    glUniform4fv(uniform.location, 1, &value.x);
+    render_stats.uniform_updates++;
+}
+
+void uniform_set_mat4(uniform_t uniform, Mat4 value) {
+    glUniformMatrix4fv(uniform.location, 1, false, &value.a.x);
+    render_stats.uniform_updates++;
+}
+
+void uniform_set_f32(uniform_t uniform, f32 value) {
+    glUniform1f(uniform.location, value);
+    render_stats.uniform_updates++;
+}
+
+void uniform_set_i32(uniform_t uniform, i32 value) {
+    glUniform1i(uniform.location, value);
+    render_stats.uniform_updates++;
 }
 
 void shader_uniform_vec4(shader_t shader, const char* name, Vec4 value) {
-    u32 loc = glGetUniformLocation(shader.handle, name);
-    glUniform4fv(loc, 1, &value.x);
+    uniform_set_vec4(shader_uniform(shader, name), value);
 }
 
 void shader_uniform_mat4(shader_t shader, const char* name, Mat4 value) {
-    u32 loc = glGetUniformLocation(shader.handle, name);
-    glUniformMatrix4fv(loc, 1, false, &value.a.x);
+    uniform_set_mat4(shader_uniform(shader, name), value);
 }
 
 void shader_uniform_f32(shader_t shader, const char* name, f32 value) {
-    u32 loc = glGetUniformLocation(shader.handle, name);
-    glUniform1f(loc, value);
+    uniform_set_f32(shader_uniform(shader, name), value);
 }
 
 void shader_uniform_i32(shader_t shader, const char* name, i32 value) {
-    u32 loc = glGetUniformLocation(shader.handle, name);
-    glUniform1i(loc, value);
+    uniform_set_i32(shader_uniform(shader, name), value);
 }
 
 // -- Texture ------------------------------------------------------------------
@@ -247,16 +1231,23 @@ texture_t texture_create(texture_desc_t desc) {
 
 void texture_destroy(texture_t texture) {
     glDeleteTextures(1, &texture.handle);
+    // Deleted textures are unbound from every unit.
+    gl_state_t* st = state();
+    for (u32 i = 0; i < MAX_TEXTURE_UNITS; i++) {
+        if (st->textures[i] == texture.handle) {
+            st->textures[i] = 0;
+        }
+    }
 }
 
 void texture_bind(texture_t texture, u32 slot) {
-    glActiveTexture(GL_TEXTURE0 + slot);
-    glBindTexture(GL_TEXTURE_2D, texture.handle);
+    state_bind_texture(slot, texture.handle);
 }
 
 void texture_resize(texture_t* texture, texture_desc_t desc) {
     texture->size.x = desc.width;
     texture->size.y = desc.height;
+    texture->generation++;
 
     u32 gl_internal_format;
     u32 gl_format;
@@ -347,7 +1338,11 @@ void texture_resize(texture_t* texture, texture_desc_t desc) {
             break;
     }
 
-    glBindTexture(GL_TEXTURE_2D, texture->handle);
+    // Modify the texture through whichever unit is active so the cache stays
+    // correct. The texture is left bound.
+    gl_state_t* st = state();
+    u32 unit = st->active_unit != STATE_UNKNOWN ? st->active_unit : 0;
+    state_bind_texture(unit, texture->handle);
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, gl_sampler);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, gl_sampler);
@@ -364,8 +1359,6 @@ void texture_resize(texture_t* texture, texture_desc_t desc) {
             gl_format,
             gl_type,
             desc.data);
-
-    glBindTexture(GL_TEXTURE_2D, 0);
 }
 
 // -- Framebuffer --------------------------------------------------------------
@@ -378,14 +1371,22 @@ framebuffer_t framebuffer_create(void) {
 
 void framebuffer_destroy(framebuffer_t fb) {
     glDeleteFramebuffers(1, &fb.handle);
+    gl_state_t* st = state();
+    if (st->framebuffer == fb.handle) {
+        st->framebuffer = 0;
+    }
 }
 
 void framebuffer_bind(framebuffer_t fb) {
-    glBindFramebuffer(GL_FRAMEBUFFER, fb.handle);
+    gl_state_t* st = state();
+    if (state_changed(st->framebuffer != fb.handle)) {
+        glBindFramebuffer(GL_FRAMEBUFFER, fb.handle);
+        st->framebuffer = fb.handle;
+    }
 }
 
 void framebuffer_unbind(void) {
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    framebuffer_bind((framebuffer_t) {0});
 }
 
 extern void framebuffer_attach(framebuffer_t fb,
@@ -410,23 +1411,28 @@ extern void framebuffer_attach(framebuffer_t fb,
             GL_TEXTURE_2D,
             texture.handle,
             0);
-    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+}
+
+static GLenum framebuffer_status(framebuffer_t fb) {
+    framebuffer_bind(fb);
+    return glCheckFramebufferStatus(GL_FRAMEBUFFER);
+}
+
+b8 framebuffer_validate(framebuffer_t fb) {
+    GLenum status = framebuffer_status(fb);
     if (status != GL_FRAMEBUFFER_COMPLETE) {
-        printf("Framebuffer is not complete: %x\n", status);
+        printf("ERROR: Framebuffer is not complete: %x\n", status);
+        return false;
     }
+    return true;
 }
 
 // -- Pipeline -----------------------------------------------------------------
 
-pipeline_t pipeline_create(pipeline_desc_t desc) {
-    pipeline_t pipeline = {
-        .desc = desc,
-    };
-    glGenVertexArrays(1, &pipeline.vao_handle);
-    glBindVertexArray(pipeline.vao_handle);
-    vertex_buffer_bind(desc.vertex_buffer);
-
-    vertex_layout_t layout = desc.vertex_layout;
+// Point the attributes of a layout at the currently bound vertex buffer,
+// starting at attribute location 'first_location' and 'base_offset' bytes into
+// the buffer.
+static void vertex_layout_apply(vertex_layout_t layout, u32 first_location, u32 base_offset) {
     for (u32 i = 0; i < layout.attrib_count; i++) {
         u32 gl_type;
         switch (layout.attribs[i].type) {
@@ -434,20 +1440,53 @@ pipeline_t pipeline_create(pipeline_desc_t desc) {
                 gl_type = GL_FLOAT;
                 break;
         }
-        glVertexAttribPointer(i,
+        u32 location = first_location + i;
+        glVertexAttribPointer(location,
                 layout.attribs[i].count,
                 gl_type,
                 false,
                 layout.stride,
-                (const void*) (layout.attribs[i].offset * sizeof(u8)));
-        glEnableVertexAttribArray(i);
+                (const void*) ((u64) (base_offset + layout.attribs[i].offset) * sizeof(u8)));
+        glVertexAttribDivisor(location, layout.divisor);
+        glEnableVertexAttribArray(location);
+    }
+}
+
+pipeline_t pipeline_create(pipeline_desc_t desc) {
+    pipeline_t pipeline = {
+        .desc = desc,
+    };
+    glGenVertexArrays(1, &pipeline.vao_handle);
+    state_bind_vao(pipeline.vao_handle);
+
+    vertex_buffer_bind(desc.vertex_buffer);
+    vertex_layout_apply(desc.vertex_layout, 0, 0);
+
+    // Instance attributes are placed right after the vertex attributes.
+    if (desc.instance_layout.attrib_count != 0) {
+        vertex_buffer_bind(desc.instance_buffer);
+        vertex_layout_apply(desc.instance_layout, desc.vertex_layout.attrib_count, 0);
     }
 
     return pipeline;
 }
 
+void pipeline_set_instance_buffer(pipeline_t* pipeline, vertex_buffer_t buffer, u32 offset) {
+    state_bind_vao(pipeline->vao_handle);
+    vertex_buffer_bind(buffer);
+    vertex_layout_apply(pipeline->desc.instance_layout,
+            pipeline->desc.vertex_layout.attrib_count,
+            offset);
+    pipeline->desc.instance_buffer = buffer;
+}
+
 void pipeline_destroy(pipeline_t pipeline) {
     glDeleteVertexArrays(1, &pipeline.vao_handle);
+    gl_state_t* st = state();
+    if (st->vao == pipeline.vao_handle) {
+        st->vao = 0;
+        st->element_buffer = STATE_UNKNOWN;
+    }
 }
 
 static GLenum blend_op_to_gl(blend_op_t op) {
@@ -480,13 +1519,33 @@ static GLenum blend_factor_to_gl(blend_factor_t factor) {
     return GL_INVALID_ENUM;
 }
 
+static b8 blend_func_equal(blend_state_t a, blend_state_t b) {
+    return a.color_op == b.color_op &&
+        a.src_color_factor == b.src_color_factor &&
+        a.dst_color_factor == b.dst_color_factor &&
+        a.alpha_op == b.alpha_op &&
+        a.src_alpha_factor == b.src_alpha_factor &&
+        a.dst_alpha_factor == b.dst_alpha_factor;
+}
+
 void pipeline_bind(pipeline_t pipeline) {
-    glBindVertexArray(pipeline.vao_handle);
+    state_bind_vao(pipeline.vao_handle);
 
+    gl_state_t* st = state();
     blend_state_t blend = pipeline.desc.blend;
-    if (blend.enabled) {
-        glEnable(GL_BLEND);
+    if (state_changed(!st->blend_known || st->blend_enabled != blend.enabled)) {
+        if (blend.enabled) {
+            glEnable(GL_BLEND);
+        } else {
+            glDisable(GL_BLEND);
+        }
+        st->blend_known = true;
+        st->blend_enabled = blend.enabled;
+    }
 
+    // The blend function only matters while blending is enabled.
+    if (blend.enabled &&
+            state_changed(!st->blend_func_known || !blend_func_equal(st->blend_func, blend))) {
         GLenum gl_color_func = blend_op_to_gl(blend.color_op);
         GLenum gl_alpha_func = blend_op_to_gl(blend.alpha_op);
         glBlendEquationSeparate(gl_color_func, gl_alpha_func);
@@ -497,42 +1556,93 @@ void pipeline_bind(pipeline_t pipeline) {
         GLenum gl_dst_alpha_factor = blend_factor_to_gl(blend.dst_alpha_factor);
         glBlendFuncSeparate(gl_src_color_factor, gl_dst_color_factor,
                 gl_src_alpha_factor, gl_dst_alpha_factor);
-    } else {
-        glDisable(GL_BLEND);
+
+        st->blend_func_known = true;
+        st->blend_func = blend;
     }
 }
 
 // -- Render pass -----------------------------------------------------------
 
+// Re-attaches every target whose texture has been reallocated since it was
+// last attached. The framebuffer is validated if anything changed or if it
+// was incomplete before. Only becoming incomplete is reported, so an invalid
+// pass doesn't log every frame.
+static void render_pass_update_targets(render_pass_t* pass) {
+    b8 changed = false;
+    for (u32 i = 0; i < pass->desc.target_count; i++) {
+        const texture_t* target = pass->desc.targets[i];
+        if (pass->target_generations[i] == target->generation) {
+            continue;
+        }
+        framebuffer_attach(pass->target_fb,
+                FRAMEBUFFER_ATTACHMENT_COLOR,
+                i,
+                *target);
+        pass->target_generations[i] = target->generation;
+        changed = true;
+    }
+    if (!changed && pass->valid) {
+        return;
+    }
+    GLenum status = framebuffer_status(pass->target_fb);
+    b8 valid = status == GL_FRAMEBUFFER_COMPLETE;
+    if (!valid && (pass->valid || changed)) {
+        printf("ERROR: Render pass framebuffer is not complete: %x\n", status);
+    }
+    pass->valid = valid;
+}
+
 render_pass_t render_pass_create(render_pass_desc_t desc) {
     render_pass_t rp = {
         .desc = desc,
-        .target_fb = framebuffer_create(),
+        // The swapchain is always complete.
+        .valid = true,
     };
+
+    if (desc.target_count != 0) {
+        i32 max_draw_buffers = 0;
+        glGetIntegerv(GL_MAX_DRAW_BUFFERS, &max_draw_buffers);
+        u32 max_targets = min((u32) max_draw_buffers, RENDER_PASS_MAX_TARGETS);
+        if (desc.target_count > max_targets) {
+            printf("ERROR: Render pass has %u targets, at most %u are supported.\n", desc.target_count, max_targets);
+            fflush(stdout);
+            abort();
+        }
+
+        rp.valid = false;
+        rp.target_fb = framebuffer_create();
+        framebuffer_bind(rp.target_fb);
+
+        // The draw buffers are framebuffer state so they only need to be set
+        // once.
+        GLenum draw_buffers[RENDER_PASS_MAX_TARGETS];
+        for (u32 i = 0; i < desc.target_count; i++) {
+            draw_buffers[i] = GL_COLOR_ATTACHMENT0 + i;
+        }
+        glDrawBuffers(desc.target_count, draw_buffers);
+
+        render_pass_update_targets(&rp);
+    }
+
     return rp;
 }
 
 void render_pass_destroy(render_pass_t pass) {
-    framebuffer_destroy(pass.target_fb);
+    if (pass.desc.target_count != 0) {
+        framebuffer_destroy(pass.target_fb);
+    }
 }
 
 void render_pass_begin(render_pass_t* pass) {
     if (pass->desc.target_count != 0) {
         framebuffer_bind(pass->target_fb);
-        GLenum draw_buffers[32];
-        for (u32 i = 0; i < pass->desc.target_count; i++) {
-            draw_buffers[i] = GL_COLOR_ATTACHMENT0 + i;
-            framebuffer_attach(pass->target_fb,
-                    FRAMEBUFFER_ATTACHMENT_COLOR,
-                    i,
-                    pass->desc.targets[i]);
-        }
-        glDrawBuffers(pass->desc.target_count, draw_buffers);
+        render_pass_update_targets(pass);
     } else {
         framebuffer_unbind();
     }
     if (pass->desc.load_op == LOAD_OP_CLEAR) {
-        glClearColor(color_arg(pass->desc.clear_color));
+        state_clear_color(pass->desc.clear_color);
         glClear(GL_COLOR_BUFFER_BIT);
     }
 }
@@ -542,9 +1652,323 @@ void render_pass_end(render_pass_t* pass) {
 }
 
 void draw(u32 vertex_count, u32 first_vertex) {
+    render_stats.draw_calls++;
     glDrawArrays(GL_TRIANGLES, vertex_count, first_vertex);
 }
 
 void draw_indexed(u32 index_count, u32 first_index) {
+    render_stats.draw_calls++;
     glDrawElements(GL_TRIANGLES, index_count, GL_UNSIGNED_INT, (const void*) (first_index*sizeof(u32)));
 }
+
+void draw_indexed_instanced(u32 index_count, u32 first_index, u32 instance_count) {
+    render_stats.draw_calls++;
+    glDrawElementsInstanced(GL_TRIANGLES,
+            index_count,
+            GL_UNSIGNED_INT,
+            (const void*) (first_index*sizeof(u32)),
+            instance_count);
+}
+
+// -- GPU timing ---------------------------------------------------------------
+// :gpu_timer
+
+#ifdef __EMSCRIPTEN__
+#include <EGL/egl.h>
+
+// WebGL 2 only has timestamp queries through EXT_disjoint_timer_query_webgl2,
+// which the GLES loader doesn't include. Its entry points are loaded when the
+// timer is initialized. WebGL has no debug groups.
+#define GL_TIMESTAMP 0x8E28
+#define GL_QUERY_COUNTER_BITS 0x8864
+#define GL_GPU_DISJOINT_EXT 0x8FBB
+
+typedef void (*gl_query_counter_ext_t)(GLuint id, GLenum target);
+typedef void (*gl_get_query_object_ui64v_ext_t)(GLuint id, GLenum pname, GLuint64* params);
+static gl_query_counter_ext_t gl_query_counter_ext = NULL;
+static gl_get_query_object_ui64v_ext_t gl_get_query_object_ui64v_ext = NULL;
+
+#define glQueryCounter(ID, TARGET) gl_query_counter_ext(ID, TARGET)
+#define glGetQueryObjectui64v(ID, PNAME, PARAMS) gl_get_query_object_ui64v_ext(ID, PNAME, PARAMS)
+#define glPushDebugGroup(...)
+#define glPopDebugGroup(...)
+
+static b8 timer_query_ext_load(void) {
+    b8 supported = false;
+    i32 count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (i32 i = 0; i < count; i++) {
+        const char* name = (const char*) glGetStringi(GL_EXTENSIONS, i);
+        if (strcmp(name, "GL_EXT_disjoint_timer_query_webgl2") == 0 ||
+                strcmp(name, "GL_EXT_disjoint_timer_query") == 0) {
+            supported = true;
+            break;
+        }
+    }
+    if (!supported) {
+        return false;
+    }
+    gl_query_counter_ext = (gl_query_counter_ext_t) eglGetProcAddress("glQueryCounterEXT");
+    gl_get_query_object_ui64v_ext = (gl_get_query_object_ui64v_ext_t) eglGetProcAddress("glGetQueryObjectui64vEXT");
+    return gl_query_counter_ext != NULL && gl_get_query_object_ui64v_ext != NULL;
+}
+#endif // __EMSCRIPTEN__
+
+// How many frames the queries are kept around for before being read.
+#define GPU_TIMER_FRAMES 4
+#define GPU_TIMER_MAX_SCOPES 64
+#define GPU_TIMER_MAX_DEPTH 16
+#define GPU_TIMER_MAX_NAMES 32
+// Number of samples the rolling stats are computed over.
+#define GPU_TIMER_WINDOW 64
+#define GPU_SCOPE_NONE 0xffffffff
+
+typedef struct gpu_scope_t gpu_scope_t;
+struct gpu_scope_t {
+    // Index into the name table.
+    u32 name;
+    b8 ended;
+};
+
+// Queries of one frame. Scope 'i' uses query '2*i' for the start timestamp
+// and '2*i+1' for the end timestamp.
+typedef struct gpu_query_set_t gpu_query_set_t;
+struct gpu_query_set_t {
+    u32 queries[GPU_TIMER_MAX_SCOPES*2];
+    gpu_scope_t scopes[GPU_TIMER_MAX_SCOPES];
+    u32 scope_count;
+    // Last query issued. Queries finish in order so once it's available all
+    // of them are.
+    u32 last_query;
+};
+
+typedef struct gpu_timer_name_t gpu_timer_name_t;
+struct gpu_timer_name_t {
+    const char* name;
+    f32 samples[GPU_TIMER_WINDOW];
+    u32 sample_count;
+};
+
+typedef struct gpu_timer_t gpu_timer_t;
+struct gpu_timer_t {
+    b8 initialized;
+    b8 available;
+
+    gpu_query_set_t sets[GPU_TIMER_FRAMES];
+    u32 frame;
+    b8 in_frame;
+
+    u32 stack[GPU_TIMER_MAX_DEPTH];
+    u32 depth;
+
+    gpu_timer_name_t names[GPU_TIMER_MAX_NAMES];
+    u32 name_count;
+};
+
+static gpu_timer_t gpu_timer = {0};
+
+static void gpu_timer_init(void) {
+    gpu_timer.initialized = true;
+#ifdef __EMSCRIPTEN__
+    if (!timer_query_ext_load()) {
+        return;
+    }
+#endif // __EMSCRIPTEN__
+    // A counter with 0 bits means timestamps aren't supported. Browsers
+    // which restrict timer precision may report that even with the
+    // extension present.
+    i32 bits = 0;
+    glGetQueryiv(GL_TIMESTAMP, GL_QUERY_COUNTER_BITS, &bits);
+    gpu_timer.available = bits > 0;
+    if (!gpu_timer.available) {
+        return;
+    }
+    for (u32 i = 0; i < GPU_TIMER_FRAMES; i++) {
+        glGenQueries(GPU_TIMER_MAX_SCOPES*2, gpu_timer.sets[i].queries);
+    }
+}
+
+static u32 gpu_timer_name_index(const char* name) {
+    for (u32 i = 0; i < gpu_timer.name_count; i++) {
+        const char* other = gpu_timer.names[i].name;
+        if (other == name || strcmp(other, name) == 0) {
+            return i;
+        }
+    }
+    if (gpu_timer.name_count == GPU_TIMER_MAX_NAMES) {
+        return GPU_SCOPE_NONE;
+    }
+    gpu_timer.names[gpu_timer.name_count] = (gpu_timer_name_t) {
+        .name = name,
+    };
+    return gpu_timer.name_count++;
+}
+
+// Reads back the results of a previous frame if the GPU is done with it. If it
+// isn't the results are dropped rather than waiting.
+static void gpu_timer_resolve(gpu_query_set_t* set) {
+    if (set->scope_count == 0) {
+        return;
+    }
+
+    u32 available = 0;
+    glGetQueryObjectuiv(set->last_query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+        return;
+    }
+#ifdef __EMSCRIPTEN__
+    // Set when something like a clock change or context loss happened while
+    // queries were in flight, which makes their results meaningless. Reading
+    // it clears it, so the frame is dropped.
+    i32 disjoint = 0;
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+    if (disjoint) {
+        return;
+    }
+#endif // __EMSCRIPTEN__
+
+    f32 frame_ms[GPU_TIMER_MAX_NAMES] = {0};
+    b8 seen[GPU_TIMER_MAX_NAMES] = {0};
+    for (u32 i = 0; i < set->scope_count; i++) {
+        gpu_scope_t scope = set->scopes[i];
+        if (!scope.ended) {
+            continue;
+        }
+        u64 start = 0;
+        u64 end = 0;
+        glGetQueryObjectui64v(set->queries[i*2], GL_QUERY_RESULT, &start);
+        glGetQueryObjectui64v(set->queries[i*2 + 1], GL_QUERY_RESULT, &end);
+        frame_ms[scope.name] += (f32) (end - start) * 1e-6f;
+        seen[scope.name] = true;
+    }
+
+    for (u32 i = 0; i < gpu_timer.name_count; i++) {
+        if (!seen[i]) {
+            continue;
+        }
+        gpu_timer_name_t* name = &gpu_timer.names[i];
+        name->samples[name->sample_count % GPU_TIMER_WINDOW] = frame_ms[i];
+        name->sample_count++;
+    }
+}
+
+b8 gpu_timer_available(void) {
+    if (!gpu_timer.initialized) {
+        gpu_timer_init();
+    }
+    return gpu_timer.available;
+}
+
+void gpu_timer_frame_begin(void) {
+    if (!gpu_timer_available()) {
+        return;
+    }
+    gpu_query_set_t* set = &gpu_timer.sets[gpu_timer.frame % GPU_TIMER_FRAMES];
+    gpu_timer_resolve(set);
+    set->scope_count = 0;
+    gpu_timer.depth = 0;
+    gpu_timer.in_frame = true;
+}
+
+void gpu_timer_frame_end(void) {
+    if (!gpu_timer.available) {
+        return;
+    }
+    gpu_timer.in_frame = false;
+    gpu_timer.frame++;
+}
+
+void gpu_scope_push(const char* name) {
+    // GPU scopes are CPU zones as well so both show up under the same name.
+    PROFILE_BEGIN(name);
+    glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0, -1, name);
+
+    u32 scope_index = GPU_SCOPE_NONE;
+    gpu_query_set_t* set = &gpu_timer.sets[gpu_timer.frame % GPU_TIMER_FRAMES];
+    if (gpu_timer.in_frame && set->scope_count < GPU_TIMER_MAX_SCOPES) {
+        u32 name_index = gpu_timer_name_index(name);
+        if (name_index != GPU_SCOPE_NONE) {
+            scope_index = set->scope_count++;
+            set->scopes[scope_index] = (gpu_scope_t) {
+                .name = name_index,
+            };
+            set->last_query = set->queries[scope_index*2];
+            glQueryCounter(set->last_query, GL_TIMESTAMP);
+        }
+    }
+
+    // Scopes nested too deep aren't tracked but the debug groups still need
+    // to be balanced.
+    if (gpu_timer.depth < GPU_TIMER_MAX_DEPTH) {
+        gpu_timer.stack[gpu_timer.depth] = scope_index;
+    }
+    gpu_timer.depth++;
+}
+
+void gpu_scope_pop(void) {
+    PROFILE_END();
+    glPopDebugGroup();
+
+    if (gpu_timer.depth == 0) {
+        return;
+    }
+    gpu_timer.depth--;
+    if (gpu_timer.depth >= GPU_TIMER_MAX_DEPTH) {
+        return;
+    }
+
+    u32 scope_index = gpu_timer.stack[gpu_timer.depth];
+    if (scope_index == GPU_SCOPE_NONE || !gpu_timer.in_frame) {
+        return;
+    }
+    gpu_query_set_t* set = &gpu_timer.sets[gpu_timer.frame % GPU_TIMER_FRAMES];
+    set->last_query = set->queries[scope_index*2 + 1];
+    glQueryCounter(set->last_query, GL_TIMESTAMP);
+    set->scopes[scope_index].ended = true;
+}
+
+u32 gpu_timer_scope_count(void) {
+    return gpu_timer.name_count;
+}
+
+gpu_timer_stats_t gpu_timer_scope_stats(u32 index) {
+    const gpu_timer_name_t* name = &gpu_timer.names[index];
+    gpu_timer_stats_t stats = {
+        .name = name->name,
+        .sample_count = min(name->sample_count, GPU_TIMER_WINDOW),
+    };
+    if (stats.sample_count == 0) {
+        return stats;
+    }
+
+    stats.min_ms = name->samples[0];
+    stats.max_ms = name->samples[0];
+    f32 sum = 0.0f;
+    for (u32 i = 0; i < stats.sample_count; i++) {
+        f32 sample = name->samples[i];
+        stats.min_ms = min(stats.min_ms, sample);
+        stats.max_ms = max(stats.max_ms, sample);
+        sum += sample;
+    }
+    stats.avg_ms = sum / stats.sample_count;
+
+    return stats;
+}
+
+gpu_timer_stats_t gpu_timer_stats(const char* name) {
+    for (u32 i = 0; i < gpu_timer.name_count; i++) {
+        if (strcmp(gpu_timer.names[i].name, name) == 0) {
+            return gpu_timer_scope_stats(i);
+        }
+    }
+    return (gpu_timer_stats_t) {0};
+}
+
+void gpu_timer_reset(void) {
+    for (u32 i = 0; i < GPU_TIMER_FRAMES; i++) {
+        gpu_timer.sets[i].scope_count = 0;
+    }
+    for (u32 i = 0; i < gpu_timer.name_count; i++) {
+        gpu_timer.names[i].sample_count = 0;
+    }
+}
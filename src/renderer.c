@@ -0,0 +1,47 @@
+//
+// Platform independent part of the renderer. Every platform implementation
+// calls into this.
+//
+
+#include "program.h"
+#include "core.h"
+
+// Address space reserved per frame arena. Only what's used is committed.
+#define FRAME_ARENA_CAPACITY (256ull << 20)
+
+void renderer_frames_init(renderer_t* renderer) {
+    for (u32 i = 0; i < RENDERER_FRAMES_IN_FLIGHT; i++) {
+        renderer->frame_arenas[i] = arena_new(FRAME_ARENA_CAPACITY);
+    }
+    renderer->frame_index = 0;
+    renderer->frame_arena_high_water = 0;
+}
+
+void renderer_frames_free(renderer_t* renderer) {
+    for (u32 i = 0; i < RENDERER_FRAMES_IN_FLIGHT; i++) {
+#ifdef ARENA_STATS_ENABLED
+        arena_report(renderer->frame_arenas[i], "frame");
+#endif // ARENA_STATS_ENABLED
+        arena_free(renderer->frame_arenas[i]);
+        renderer->frame_arenas[i] = NULL;
+    }
+}
+
+void renderer_frame_begin(renderer_t* renderer) {
+    arena_t* prev = renderer_frame_arena(renderer);
+    renderer->frame_arena_high_water = max(renderer->frame_arena_high_water, arena_pos(prev));
+
+    renderer->frame_index++;
+    // Popped rather than cleared. Clearing would give the memory back to the
+    // OS just to commit it again in the same frame.
+    arena_pop_to(renderer_frame_arena(renderer), 0);
+}
+
+arena_t* renderer_frame_arena(renderer_t* renderer) {
+    return renderer->frame_arenas[renderer->frame_index % RENDERER_FRAMES_IN_FLIGHT];
+}
+
+u64 renderer_frame_arena_high_water(const renderer_t* renderer) {
+    const arena_t* current = renderer->frame_arenas[renderer->frame_index % RENDERER_FRAMES_IN_FLIGHT];
+    return max(renderer->frame_arena_high_water, arena_pos(current));
+}
@@ -0,0 +1,192 @@
+#include "shader_preprocessor.h"
+#include "core.h"
+#include "profiler.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef __EMSCRIPTEN__
+#define SHADER_VERSION "#version 300 es\n"
+#define SHADER_FRAGMENT_PRECISION "precision mediump float;\n"
+#else
+#define SHADER_VERSION "#version 330 core\n"
+#define SHADER_FRAGMENT_PRECISION ""
+#endif // __EMSCRIPTEN__
+
+// Growable output buffer. The result is copied onto the arena at the end.
+typedef struct pp_buffer_t pp_buffer_t;
+struct pp_buffer_t {
+    char* data;
+    u32 len;
+    u32 cap;
+};
+
+static void pp_reserve(pp_buffer_t* buffer, u32 len) {
+    if (buffer->len + len > buffer->cap) {
+        buffer->cap = max(buffer->cap * 2, buffer->len + len);
+        buffer->data = realloc(buffer->data, buffer->cap);
+    }
+}
+
+static void pp_write(pp_buffer_t* buffer, const char* data, u32 len) {
+    pp_reserve(buffer, len);
+    memcpy(buffer->data + buffer->len, data, len);
+    buffer->len += len;
+}
+
+// Formats straight into the buffer, growing it to fit, so long defines are
+// never cut off.
+static void pp_printf(pp_buffer_t* buffer, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    va_list measure_args;
+    va_copy(measure_args, args);
+    i32 len = vsnprintf(NULL, 0, fmt, measure_args);
+    va_end(measure_args);
+    if (len < 0) {
+        printf("ERROR: Failed to format shader preprocessor output '%s'.\n", fmt);
+        fflush(stdout);
+        abort();
+    }
+
+    // vsnprintf writes a terminator that isn't part of the output.
+    pp_reserve(buffer, len + 1);
+    vsnprintf(buffer->data + buffer->len, len + 1, fmt, args);
+    va_end(args);
+    buffer->len += len;
+}
+
+typedef struct pp_state_t pp_state_t;
+struct pp_state_t {
+    const shader_preprocess_desc_t* desc;
+    pp_buffer_t out;
+    // Every file included so far. Its index + 1 is its source string number.
+    str_t includes[SHADER_MAX_INCLUDES];
+    u32 include_count;
+};
+
+static b8 is_space(u8 c) {
+    return c == ' ' || c == '\t';
+}
+
+// Returns true and the name if the line is an include directive.
+static b8 parse_include(str_t line, str_t* name) {
+    u32 i = 0;
+    while (i < line.len && is_space(line.data[i])) {
+        i++;
+    }
+    const char directive[] = "#include";
+    u32 directive_len = sizeof(directive) - 1;
+    if (line.len - i < directive_len || memcmp(line.data + i, directive, directive_len) != 0) {
+        return false;
+    }
+    i += directive_len;
+    while (i < line.len && is_space(line.data[i])) {
+        i++;
+    }
+    if (i == line.len || line.data[i] != '"') {
+        return false;
+    }
+    u32 start = ++i;
+    while (i < line.len && line.data[i] != '"') {
+        i++;
+    }
+    if (i == line.len) {
+        return false;
+    }
+    *name = str(line.data + start, i - start);
+    return true;
+}
+
+static b8 pp_file(pp_state_t* state, str_t source, str_t name, u32 source_index, u32 depth) {
+    if (depth > SHADER_MAX_INCLUDE_DEPTH) {
+        printf("ERROR: Shader includes nested too deep in '%.*s'.\n", str_arg(name));
+        return false;
+    }
+
+    u32 line_number = 1;
+    for (u32 i = 0; i < source.len; line_number++) {
+        u32 start = i;
+        while (i < source.len && source.data[i] != '\n') {
+            i++;
+        }
+        // Keep the newline with the line.
+        if (i < source.len) {
+            i++;
+        }
+        str_t line = str(source.data + start, i - start);
+
+        str_t include;
+        if (!parse_include(line, &include)) {
+            pp_write(&state->out, (const char*) line.data, line.len);
+            continue;
+        }
+
+        b8 included = false;
+        for (u32 j = 0; j < state->include_count; j++) {
+            str_t other = state->includes[j];
+            if (other.len == include.len && memcmp(other.data, include.data, include.len) == 0) {
+                included = true;
+                break;
+            }
+        }
+        if (included) {
+            pp_write(&state->out, "\n", 1);
+            continue;
+        }
+        if (state->include_count == SHADER_MAX_INCLUDES) {
+            printf("ERROR: Too many shader includes in '%.*s'.\n", str_arg(name));
+            return false;
+        }
+
+        str_t content = state->desc->resolve_include != NULL ?
+            state->desc->resolve_include(state->desc->user_ptr, include) :
+            (str_t) {0};
+        if (content.data == NULL) {
+            printf("ERROR: Shader include '%.*s' not found, included from '%.*s' line %u.\n",
+                    str_arg(include), str_arg(name), line_number);
+            return false;
+        }
+        u32 include_index = ++state->include_count;
+        state->includes[include_index - 1] = include;
+
+        pp_printf(&state->out, "#line 1 %u\n", include_index);
+        if (!pp_file(state, content, include, include_index, depth + 1)) {
+            return false;
+        }
+        if (content.len > 0 && content.data[content.len - 1] != '\n') {
+            pp_write(&state->out, "\n", 1);
+        }
+        pp_printf(&state->out, "#line %u %u\n", line_number + 1, source_index);
+    }
+    return true;
+}
+
+str_t shader_preprocess(arena_t* arena, shader_preprocess_desc_t desc) {
+    PROFILE_BEGIN("shader_preprocess");
+    pp_state_t state = {
+        .desc = &desc,
+    };
+
+    pp_printf(&state.out, SHADER_VERSION);
+    if (desc.stage == SHADER_STAGE_FRAGMENT) {
+        pp_printf(&state.out, SHADER_FRAGMENT_PRECISION);
+    }
+    for (u32 i = 0; i < desc.define_count; i++) {
+        const shader_define_t* define = &desc.defines[i];
+        pp_printf(&state.out, "#define %s %s\n", define->name, define->value != NULL ? define->value : "");
+    }
+    pp_printf(&state.out, "#line 1 0\n");
+
+    str_t result = {0};
+    if (pp_file(&state, desc.source, desc.name, 0, 0)) {
+        u8* data = arena_push(arena, state.out.len + 1);
+        memcpy(data, state.out.data, state.out.len);
+        data[state.out.len] = 0;
+        result = str(data, state.out.len);
+    }
+    free(state.out.data);
+    PROFILE_END();
+    return result;
+}
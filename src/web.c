@@ -87,6 +87,7 @@ renderer_t* renderer_new(u32 width, u32 height, const char *title) {
     *rend = (renderer_t) {
         .data = em_rend,
     };
+    renderer_frames_init(rend);
 
     if (!gladLoaderLoadGLES2()) {
         printf("ERROR: GLAD failed to load OpenGL functions.\n");
@@ -108,6 +109,7 @@ void renderer_free(renderer_t* renderer) {
     eglDestroyContext(em_rend->display, em_rend->context);
     eglDestroySurface(em_rend->display, em_rend->surface);
     eglTerminate(em_rend->display);
+    renderer_frames_free(renderer);
 
     free(em_rend);
     renderer->data = NULL;
@@ -120,6 +122,7 @@ void renderer_swap_buffers(renderer_t* renderer) {
 
 static void internal_main_loop(void* user_ptr) {
     renderer_t* renderer = user_ptr;
+    renderer_frame_begin(renderer);
     if (renderer->update_cb != NULL) {
         renderer->update_cb(renderer);
     }